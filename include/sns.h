@@ -69,6 +69,9 @@
 typedef double sns_real_t;
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <sys/types.h>
 #include <time.h>
 #include <pthread.h>
 #include <fcntl.h>
@@ -78,6 +81,7 @@ typedef double sns_real_t;
 #include <syslog.h>
 
 #include "sns/util.h"
+#include "sns/periodic.h"
 #include "sns/msg.h"
 #include "sns/daemon.h"
 #include "sns/path.h"
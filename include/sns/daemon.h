@@ -90,6 +90,7 @@ typedef struct sns_cx {
     volatile sig_atomic_t shutdown;  ///< set to true when system should shutdown
     int verbosity;                   ///< how much output to give.  Add SNS_LOG_LEVEL to get priority
     FILE *stderr;                    ///< file handler for printing log/error messages
+    struct sns_msg_header header;    ///< template header for outgoing messages
 } sns_cx_t;
 
 /**
@@ -117,14 +118,129 @@ enum sns_prio {
 void sns_init( void );
 
 
+/**
+ * Scheduling policies for real-time processes and threads.
+ */
+enum sns_sched_policy {
+    SNS_SCHED_DEFAULT = 0,  ///< SCHED_RR when prio is set, else unchanged
+    SNS_SCHED_OTHER,        ///< SCHED_OTHER
+    SNS_SCHED_FIFO,         ///< SCHED_FIFO at prio
+    SNS_SCHED_RR,           ///< SCHED_RR at prio
+    SNS_SCHED_DEADLINE      ///< SCHED_DEADLINE, prio is ignored
+};
+
+/**
+ * Default bytes of stack to prefault.
+ */
+#define SNS_PREFAULT_STACK_DEFAULT (256*1024)
+
+/**
+ * Largest stack prefault, to stay within the default thread stack.
+ */
+#define SNS_PREFAULT_STACK_MAX (4*1024*1024)
+
+/**
+ * Real-time settings for a process or thread.
+ *
+ * Zero-initialize, then set the fields of interest.
+ */
 struct sns_init_rt_opts {
+    /**
+     * Priority for SNS_SCHED_FIFO and SNS_SCHED_RR.
+     */
     enum sns_prio prio;
+
+    /**
+     * Scheduling policy.
+     */
+    enum sns_sched_policy policy;
+
+    /**
+     * Runtime budget per period for SNS_SCHED_DEADLINE.
+     *
+     * A SCHED_DEADLINE thread may only create threads when they reset
+     * to SCHED_OTHER, so threads it creates afterwards, such as event
+     * loop and log threads, start as SCHED_OTHER.  Give them their own
+     * settings, e.g., with sns_evhandle_opts.rt.
+     */
+    uint64_t dl_runtime_ns;
+
+    /**
+     * Relative deadline for SNS_SCHED_DEADLINE, or zero for the
+     * period.
+     */
+    uint64_t dl_deadline_ns;
+
+    /**
+     * Period for SNS_SCHED_DEADLINE.
+     */
+    uint64_t dl_period_ns;
+
+    /**
+     * CPUs to run on, or NULL to leave the affinity unchanged.  Use
+     * isolated CPUs (isolcpus=, nohz_full=) for the lowest jitter.
+     * Not permitted with SNS_SCHED_DEADLINE, which is admitted over
+     * the whole root domain.
+     */
+    const cpu_set_t *affinity;
+
+    /**
+     * Bytes of stack to touch, or zero for SNS_PREFAULT_STACK_DEFAULT.
+     */
+    size_t prefault_stack;
+
+    /**
+     * Bytes of heap to touch and keep in the allocator, or zero for
+     * none.  Process-wide, so only applies in sns_init_rt().
+     */
+    size_t prefault_heap;
+
+    /**
+     * Bytes of the thread-local memory region to touch, or zero for
+     * none.
+     */
+    size_t prefault_region;
+};
+
+/**
+ * Real-time settings that took effect, a bitwise or.
+ */
+enum sns_rt_applied {
+    SNS_RT_SCHED            = 0x01,  ///< scheduling policy and priority
+    SNS_RT_AFFINITY         = 0x02,  ///< CPU affinity
+    SNS_RT_MLOCK            = 0x04,  ///< current and future pages locked
+    SNS_RT_PREFAULT_STACK   = 0x08,  ///< stack touched
+    SNS_RT_PREFAULT_HEAP    = 0x10,  ///< heap touched and retained
+    SNS_RT_PREFAULT_REGION  = 0x20   ///< memory region touched
 };
 
 /**
  * Make real-time
+ *
+ * Initializes the daemon, applies opts to the calling thread, and
+ * locks memory.  Threads created afterwards inherit the scheduling
+ * policy and affinity.  Settings that fail are logged and skipped.
+ *
+ * @return the enum sns_rt_applied settings that took effect
  */
-void sns_init_rt( const struct sns_init_rt_opts *opts );
+int sns_init_rt( const struct sns_init_rt_opts *opts );
+
+/**
+ * Apply the per-thread settings of opts to the calling thread.
+ *
+ * Scheduling, affinity, and stack and region prefaulting are per
+ * thread; memory locking and heap prefaulting are not and are only
+ * done by sns_init_rt().  Also allocates the thread's asynchronous log
+ * ring if sns_log_async_start() was called.
+ *
+ * @return the enum sns_rt_applied settings that took effect
+ */
+int sns_init_rt_thread( const struct sns_init_rt_opts *opts );
+
+/**
+ * Log the settings that took effect.
+ */
+void sns_rt_log( int priority, const char *name, int applied );
 
 /**
  * Indicate that daemon is beginning its normal execuation.
@@ -160,6 +276,17 @@ void sns_end( void );
  */
 void sns_sigcancel( ach_channel_t **chan, const int sig[] );
 
+/**
+ * Also signal a descriptor on cancel.
+ *
+ * The signal handler installed by sns_sigcancel() will write an
+ * eventfd count of one to fd, waking a thread that waits on
+ * descriptors rather than channels.
+ *
+ * @param[in] fd an eventfd, or -1 for none
+ */
+void sns_sigcancel_notify( int fd );
+
 /**
  * Signals which should terminate the process.
  *
@@ -187,6 +314,125 @@ void sns_event( int level, int code, const char fmt[], ... )
 #endif
     ;
 
+/**
+ * Default entries of each thread's asynchronous log ring.
+ */
+#define SNS_LOG_ASYNC_ENTRIES_DEFAULT 256
+
+/**
+ * Default period of the asynchronous log flusher.
+ */
+#define SNS_LOG_ASYNC_PERIOD_NS_DEFAULT 10000000
+
+/**
+ * Options for sns_log_async_start().
+ */
+struct sns_log_async_opts {
+    /**
+     * Ring entries per thread, rounded up to a power of two, or zero
+     * for SNS_LOG_ASYNC_ENTRIES_DEFAULT.
+     */
+    size_t entries;
+
+    /**
+     * How often the flusher publishes queued messages, or NULL for
+     * SNS_LOG_ASYNC_PERIOD_NS_DEFAULT.
+     */
+    const struct timespec *period;
+};
+
+/**
+ * Queue log messages instead of publishing them on the calling thread.
+ *
+ * Afterwards, sns_event() below LOG_CRIT stores the format pointer and
+ * packed arguments in a preallocated ring of the calling thread, and
+ * a flusher thread formats and publishes them.  When a ring is full,
+ * messages are dropped and the flusher logs how many.  No stack trace
+ * is printed for queued messages.
+ *
+ * Format strings must stay valid until flushed, e.g., be literals.
+ * Conversions that cannot be packed (%n, %m, wide characters) and
+ * messages with long string arguments are formatted on the calling
+ * thread, truncated, and still queued.
+ */
+void sns_log_async_start( const struct sns_log_async_opts *opts );
+
+/**
+ * Stop the flusher after publishing queued messages.
+ *
+ * sns_event() publishes on the calling thread again.
+ */
+void sns_log_async_stop( void );
+
+/**
+ * Publish queued messages on the calling thread without stopping the
+ * flusher.
+ *
+ * Safe to call from sns_die(): waits at most one second for the
+ * flusher and does nothing when logging is not asynchronous.
+ */
+void sns_log_async_flush( void );
+
+/**
+ * Allocate the calling thread's ring now rather than on its first
+ * message.  Call from real-time threads before entering their loop.
+ */
+void sns_log_async_thread_init( void );
+
+/**
+ * Queue a log message on the calling thread's ring.
+ *
+ * @return nonzero if the message was queued or dropped, zero if
+ * asynchronous logging is not running.
+ */
+int sns_log_async_vput( int level, const char fmt[], va_list ap );
+
+/**
+ * Total messages dropped because rings were full.
+ */
+uint64_t sns_log_async_dropped( void );
+
+/**
+ * Most octets of packed arguments in a log message from
+ * sns_log_packed_vput().
+ */
+#define SNS_LOG_PACKED_ARGS_MAX 1024
+
+/**
+ * Publish log messages as struct sns_msg_log_packed, leaving
+ * formatting to the reader.
+ *
+ * Readers of the log channel must then use sns_msg_log_text().  Also
+ * enabled by a nonempty SNS_LOG_PACKED environment variable other than
+ * "0".  Messages printed to stderr are always formatted.
+ */
+void sns_log_set_packed( int packed );
+
+/**
+ * Publish a packed log message on the calling thread.
+ *
+ * @return nonzero if published, zero if packing is disabled or fmt
+ * has conversions that cannot be packed
+ */
+int sns_log_packed_vput( int level, const char fmt[], va_list ap );
+
+/**
+ * Pack the arguments of a printf format into buf.
+ *
+ * @return the bytes used, or -1 if they do not fit or fmt has
+ * conversions that cannot be packed
+ */
+ssize_t sns_log_pack( const char fmt[], va_list ap, void *buf, size_t size );
+
+/**
+ * Format arguments packed by sns_log_pack() into out, like snprintf().
+ *
+ * @return the length of the complete text, or -1 if buf does not match
+ * fmt
+ */
+int sns_log_render( const char fmt[], const void *buf, size_t size,
+                    char *out, size_t n );
+
 /**
  * Terminate the process.
  */
@@ -197,6 +443,116 @@ void sns_die( void );
  */
 #define SNS_DIE( ... ) { sns_event( LOG_CRIT, 0, __VA_ARGS__ ); sns_die(); }
 
+/*
+ * Rate limiting.
+ *
+ * Each SNS_LOG and SNS_CHECK site has a token bucket.  While it has
+ * tokens, logging costs one extra branch.  When it runs out, the
+ * bucket is refilled at SNS_LOG_RATE per second up to SNS_LOG_BURST,
+ * and messages in between are counted instead of sent.  Counts are
+ * summarized as "N messages suppressed" at most every
+ * SNS_LOG_SUMMARY_NS per site.  A site is its call site, not its
+ * text, so reports that log many different lines from one site call
+ * sns_event() directly.
+ *
+ * Define SNS_LOG_RATE to 0 before including sns.h to disable.
+ */
+
+#ifndef SNS_LOG_RATE
+/** Messages per second from one site once its burst is spent. */
+#define SNS_LOG_RATE 10
+#endif
+
+#ifndef SNS_LOG_BURST
+/** Messages one site may send without limit. */
+#define SNS_LOG_BURST 20
+#endif
+
+/** Minimum time between summaries of one site. */
+#define SNS_LOG_SUMMARY_NS 1000000000
+
+/**
+ * Rate limit of a logging call site.
+ */
+struct sns_log_site {
+    int64_t tokens;             ///< messages before refilling
+    int64_t refill_ns;          ///< time tokens were last added, 0 before first use
+    int64_t summary_ns;         ///< time of the last summary
+    uint64_t suppressed;        ///< suppressed since the last summary
+    uint64_t suppressed_total;  ///< all suppressed messages
+    int64_t rate;               ///< tokens per second
+    int64_t burst;              ///< most tokens
+    const char *file;           ///< source file of the site
+    int line;                   ///< source line of the site
+    int priority;               ///< priority of the last message
+    int listed;                 ///< added to the summary list
+    struct sns_log_site *next;  ///< next in the summary list
+};
+
+/**
+ * Initializer for a struct sns_log_site.
+ *
+ * The site starts empty so that its first message fills the burst and
+ * starts the refill clock.
+ */
+#define SNS_LOG_SITE_INIT                                               \
+    { 0, 0, 0, 0, 0, SNS_LOG_RATE, SNS_LOG_BURST,                      \
+      __FILE__, __LINE__, LOG_DEBUG, 0, NULL }
+
+/**
+ * Refill site, or count a suppressed message of priority.
+ *
+ * @return nonzero if the message may be sent
+ */
+int sns_log_site_refill( struct sns_log_site *site, int priority );
+
+/**
+ * Take a token from site.
+ *
+ * @return nonzero if the message may be sent
+ */
+static inline int
+sns_log_site_allow( struct sns_log_site *site, int priority )
+{
+    int64_t tokens = __atomic_load_n( &site->tokens, __ATOMIC_RELAXED );
+    if( __builtin_expect(tokens > 0, 1) ) {
+        __atomic_store_n( &site->tokens, tokens - 1, __ATOMIC_RELAXED );
+        return 1;
+    }
+    return sns_log_site_refill( site, priority );
+}
+
+/**
+ * Log summaries now for all sites with suppressed messages.
+ *
+ * Called by sns_end().  Otherwise, a site is summarized when it is
+ * refilled, and by the asynchronous log flusher, at most every
+ * SNS_LOG_SUMMARY_NS.  Without the flusher, call this from a periodic
+ * task to get summaries after a flood stops.
+ */
+void sns_log_summarize( void );
+
+/**
+ * Total messages suppressed by rate limiting.
+ */
+uint64_t sns_log_suppressed( void );
+
+#if SNS_LOG_RATE > 0
+/**
+ * Send a message subject to the rate limit of this call site.
+ */
+#define SNS_LOG_LIMITED( priority, code, ... )                          \
+    {                                                                   \
+        static struct sns_log_site sns_log_site_ = SNS_LOG_SITE_INIT;   \
+        if( sns_log_site_allow(&sns_log_site_, priority) ) {            \
+            sns_event( priority, code, __VA_ARGS__ );                   \
+        }                                                               \
+    }
+#else
+#define SNS_LOG_LIMITED( priority, code, ... )                          \
+    { sns_event( priority, code, __VA_ARGS__ ); }
+#endif
+
 /* Macros for to check and require conditions.
  * Other arguments are only evaluated if the test fails.
  */
@@ -204,7 +560,7 @@ void sns_die( void );
 /** Check whether condition is satisfied and log if false
  */
 #define SNS_CHECK( test, priority, code, fmt, ... )                     \
-    if( !(test) ) { sns_event( priority, code, fmt, __VA_ARGS__); }
+    if( !(test) ) SNS_LOG_LIMITED( priority, code, fmt, __VA_ARGS__ )
 
 /**
  * If test is false, then die
@@ -230,12 +586,13 @@ void sns_die( void );
  * Publish a log message
  *
  * The arguments are a log priority level, a printf format string, and
- * the format string arguments.
+ * the format string arguments.  Messages are rate limited per call
+ * site.
  *
  * @param[in] priority a syslog logging priority
  */
 #define SNS_LOG( priority, ... )                                        \
-    if( SNS_LOG_PRIORITY(priority) ) { sns_event( priority, 0,  __VA_ARGS__); }
+    if( SNS_LOG_PRIORITY(priority) ) SNS_LOG_LIMITED( priority, 0, __VA_ARGS__ )
 
 /********************/
 /* Channel Handlers */
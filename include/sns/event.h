@@ -47,6 +47,132 @@
 extern "C" {
 #endif
 
+/**
+ * Where an event handler runs
+ */
+enum sns_evhandler_thread {
+    SNS_EVHANDLER_THREAD_MAIN = 0,   ///< the thread calling sns_evhandle()
+    SNS_EVHANDLER_THREAD_DEDICATED,  ///< a thread of its own
+    SNS_EVHANDLER_THREAD_POOL        ///< the shared worker pool
+};
+
+/**
+ * How an event handler consumes pending frames
+ */
+enum sns_evhandler_mode {
+    /** One frame per wakeup */
+    SNS_EVHANDLER_EACH = 0,
+    /** Every pending frame, releasing the memory region once at the end */
+    SNS_EVHANDLER_DRAIN,
+    /** Only the newest frame, counting those skipped */
+    SNS_EVHANDLER_LATEST,
+    /** Pending frames passed together to coalesce_handler */
+    SNS_EVHANDLER_COALESCE
+};
+
+/**
+ * Default for sns_evhandler.batch_max
+ */
+#define SNS_EVHANDLER_BATCH_DEFAULT 64
+
+/**
+ * A message passed to sns_evhandler.coalesce_handler
+ */
+struct sns_evframe {
+    void *msg;          ///< the message
+    size_t msg_size;    ///< size of msg
+};
+
+/**
+ * Reasons sns_evfilter drops a message
+ */
+enum sns_evfilter_drop {
+    SNS_EVFILTER_SIZE = 0,    ///< too small for the header or the expected type and size
+    SNS_EVFILTER_EXPIRED,     ///< past its duration
+    SNS_EVFILTER_OLD,         ///< sequence number not after the last delivered one
+    SNS_EVFILTER_INTERVAL,    ///< too soon after the last delivery
+    SNS_EVFILTER_DROP_MAX     ///< number of reasons
+};
+
+/**
+ * Return a string describing a filter drop reason.
+ */
+const char *sns_evfilter_drop_string( enum sns_evfilter_drop reason );
+
+/**
+ * Filter settings, state, and counts for a handler.
+ *
+ * Filters run before validation and before the handler is called,
+ * and only look at the header and frame size.
+ */
+struct sns_evfilter {
+    const struct sns_msg_type *type;  ///< expected type, or NULL
+    size_t size;                      ///< expected frame size without a type, or zero for any
+    int drop_expired;                 ///< drop expired messages
+    int drop_old;                     ///< drop messages not newer than the last from the same sender
+    int64_t min_interval_ns;          ///< least time between deliveries, or zero
+
+    int64_t last_pid;                 ///< sender of the last delivered message
+    uint64_t last_seq;                ///< sequence number of the last delivered message
+    struct timespec last_delivery;    ///< time of the last delivery
+
+    uint64_t passed;                  ///< messages delivered
+    uint64_t dropped[SNS_EVFILTER_DROP_MAX]; ///< dropped messages by reason
+};
+
+/**
+ * Initialize a filter that passes everything.
+ */
+void sns_evfilter_init( struct sns_evfilter *filter );
+
+/**
+ * Check a message against the filter and count the result.
+ *
+ * @return true if the message passes
+ */
+int sns_evfilter_pass( struct sns_evfilter *filter, const void *msg, size_t frame_size );
+
+/**
+ * Log the filter counts.
+ */
+void sns_evfilter_log( const struct sns_evfilter *filter, int priority, const char *name );
+
+/**
+ * Busy-poll settings and statistics for a handler.
+ *
+ * Before blocking, the handler polls its channel for up to the
+ * current budget.  For channels in process memory, polls watch the
+ * channel's sequence counter without taking its lock and only read
+ * once a new frame is published.  The budget shrinks while frames keep arriving
+ * after it runs out and grows back when they arrive within it.
+ */
+struct sns_evspin {
+    int64_t budget_ns;          ///< most time to spin before blocking
+    int64_t current_ns;         ///< budget adapted to recent arrivals
+
+    uint64_t hits;              ///< waits ended by a frame while spinning
+    uint64_t misses;            ///< waits that fell back to blocking
+    int64_t spin_ns;            ///< total time spent spinning
+
+    uint64_t hit_msgs;          ///< timestamped messages received while spinning
+    int64_t hit_latency_ns;     ///< their summed latency
+    uint64_t miss_msgs;         ///< timestamped messages received after blocking
+    int64_t miss_latency_ns;    ///< their summed latency
+
+    int spinning;               ///< true while handling a frame received by spinning
+};
+
+/**
+ * Initialize busy-poll settings with the given spin budget.
+ */
+void sns_evspin_init( struct sns_evspin *spin, const struct timespec *budget );
+
+/**
+ * Log busy-poll statistics: CPU time spent spinning and the mean
+ * latency of messages received while spinning versus after blocking.
+ */
+void sns_evspin_log( const struct sns_evspin *spin, int priority, const char *name );
+
 /**
  * Control structure for event handling loop
  */
@@ -71,7 +197,7 @@ struct sns_evhandler {
      *
      * Called whenever there is new data in the channel.
      *
-     * msg is deallocated after handler returns.
+     * msg is only valid until the handler returns.
      *
      * Handler should return ACH_OK when new frames are read, or
      * ACH_STALE_FRAMES if no new frames are read.  Any other
@@ -79,8 +205,120 @@ struct sns_evhandler {
      */
     enum ach_status (*handler)
     ( void *context, void *msg, size_t msg_size );
+
+    /**
+     * Pass messages to the handler in place.
+     *
+     * When true, msg points directly into channel memory instead of
+     * to a copy in the thread-local memory region.  msg must then be
+     * treated as read-only.  The channel stays locked until the
+     * handler returns, so the handler should be short and should copy
+     * anything it needs to keep.
+     *
+     * @warning Every writer to the channel, including real-time
+     * producers in other processes, blocks in ach_put() for as long
+     * as the handler runs.  Only use in_place when the handler is
+     * cheaper than copying the frame, and never on channels with
+     * writers that must not block.
+     */
+    int in_place;
+
+    /**
+     * If not NULL, updated with the sequence numbers and latency of
+     * each received message.
+     */
+    struct sns_msg_tracker *tracker;
+
+    /**
+     * If not NULL, each message is validated first, and invalid
+     * messages are counted and dropped without calling the handler.
+     */
+    struct sns_msg_validator *validator;
+
+    /**
+     * If not NULL, messages are filtered before validation, and
+     * dropped messages are counted without calling the handler.
+     */
+    struct sns_evfilter *filter;
+
+    /**
+     * Thread to run the handler on.
+     *
+     * Messages from one channel are always handled in order, one at a
+     * time, and each thread has its own thread-local memory region.
+     * Pooled channels are received on the main thread and queued for
+     * the pool, so in_place does not apply to them.  Handlers off the
+     * main thread must synchronize any state they share.
+     */
+    enum sns_evhandler_thread thread;
+
+    /**
+     * How to consume frames that queued up while the handler was
+     * busy, so that a lagging consumer catches up.
+     *
+     * Pooled channels always use SNS_EVHANDLER_EACH; their queue
+     * drops the oldest frames instead.
+     */
+    enum sns_evhandler_mode mode;
+
+    /**
+     * Most frames read per wakeup in SNS_EVHANDLER_DRAIN and
+     * SNS_EVHANDLER_COALESCE modes, or zero for
+     * SNS_EVHANDLER_BATCH_DEFAULT.
+     */
+    size_t batch_max;
+
+    /**
+     * Handler for SNS_EVHANDLER_COALESCE mode, called in place of
+     * handler with the n frames read on one wakeup, oldest first.
+     * Messages of batch frames are passed individually.  The frames
+     * are only valid until the handler returns.  in_place does not
+     * apply.  Required in SNS_EVHANDLER_COALESCE mode.
+     */
+    enum ach_status (*coalesce_handler)
+    ( void *context, struct sns_evframe *frames, size_t n );
+
+    /**
+     * Frames skipped in SNS_EVHANDLER_LATEST mode.
+     */
+    uint64_t skipped;
+
+    /**
+     * If not NULL, updated with frame, byte, runtime, and latency
+     * counters.  Compiled out when libsns is configured with
+     * --disable-evstats.
+     */
+    struct sns_evstats *stats;
+
+    /**
+     * If not NULL, busy-poll the channel before blocking on it.
+     *
+     * Only applies to handlers waiting on their channel alone: a
+     * dedicated thread, or the only main-thread channel.  Spinning
+     * occupies a CPU, so use it on isolated cores.
+     */
+    struct sns_evspin *spin;
+
+    /**
+     * Real-time settings for threads serving only this channel: its
+     * dedicated thread or epoll watcher.  NULL uses
+     * sns_evhandle_opts.rt.
+     */
+    const struct sns_init_rt_opts *rt;
 };
 
+/**
+ * Log handler statistics.
+ */
+void sns_evstats_log( const struct sns_evstats *stats, int priority, const char *name );
+
+/**
+ * Publish the statistics of handlers as a struct sns_msg_evstats with
+ * one element per handler; handlers without statistics are zero.
+ */
+enum ach_status
+sns_evstats_put( ach_channel_t *chan, const struct sns_evhandler *handlers, size_t n );
+
 /**
  * Event loop for handling multiple channels.
  *
@@ -103,6 +341,13 @@ struct sns_evhandler {
  * @param[in] options          bit flags, may include
  *                             ACH_EV_O_PERIODIC_INPUT and
  *                             ACH_EV_O_PERIODIC_TIMEOUT
+ *
+ * Batch frames (struct sns_msg_batch) are unpacked, and the handler
+ * is called once for each sub-message.
+ *
+ * While a handler runs, sns_time_get() returns the time of the
+ * wakeup that dispatched it, so timestamps and expiry checks within
+ * the handler are consistent.
  */
 enum ach_status ACH_WARN_UNUSED
 sns_evhandle( struct sns_evhandler *handlers,
@@ -113,6 +358,135 @@ sns_evhandle( struct sns_evhandler *handlers,
               int *cancel_sigs,
               int options );
 
+/**
+ * How sns_evhandle_run() waits on multiple main-thread and pooled
+ * channels.  A single main-thread channel is always waited on
+ * directly.
+ */
+enum sns_evhandle_backend {
+    /**
+     * ach_evhandle(), which checks every channel on each wakeup.
+     * When anything runs on absolute deadlines (a periodic handler
+     * with ACH_EV_O_PERIODIC_TIMEOUT, timers, or statistics), each
+     * wait times out at the next release.  The right choice for
+     * shared memory channels.
+     */
+    SNS_EVHANDLE_BACKEND_ACH = 0,
+
+    /**
+     * epoll on the channel descriptors, so a wakeup only visits the
+     * ready channels.  Only useful when the channels are kernel
+     * channels, see sns_evhandle_pollable(), and many of them.
+     *
+     * Shared memory channels have no pollable descriptor, so each
+     * gets a watcher thread that receives frames and hands them to
+     * the main thread.  That costs a thread per channel and two
+     * context switches per frame, so do not use this backend for
+     * them on latency-sensitive paths.  in_place does not apply to
+     * them.  spin does not apply.
+     */
+    SNS_EVHANDLE_BACKEND_EPOLL
+};
+
+/**
+ * Check whether the epoll backend can wait on a channel directly,
+ * i.e., whether it is a kernel channel.
+ */
+int sns_evhandle_pollable( const ach_channel_t *channel );
+
+/**
+ * Options for sns_evhandle_run()
+ */
+struct sns_evhandle_opts {
+    /**
+     * Timeout to wait between execution of periodic_handler.
+     *
+     * With ACH_EV_O_PERIODIC_TIMEOUT, periodic_handler is released on
+     * absolute deadlines, so the period does not drift with handler
+     * runtime or input.
+     */
+    const struct timespec *period;
+
+    /**
+     * Function to execute periodically, or NULL.
+     */
+    enum ach_status (*periodic_handler)(void *context);
+
+    /**
+     * Context argument to periodic_handler.
+     */
+    void *periodic_context;
+
+    /**
+     * Signals to cancel the loop on, zero-terminated, or NULL.
+     */
+    int *cancel_sigs;
+
+    /**
+     * ACH_EV_O_PERIODIC_INPUT and ACH_EV_O_PERIODIC_TIMEOUT flags.
+     */
+    int options;
+
+    /**
+     * Schedule for periodic_handler, or NULL to use period, skipping
+     * missed releases.  Initialize it with sns_periodic_init(); its
+     * statistics are updated as the loop runs.
+     */
+    struct sns_periodic *periodic;
+
+    /**
+     * Timers to run from the event loop, or NULL.  The wheel is only
+     * used by the thread calling sns_evhandle_run().
+     */
+    struct sns_timer_wheel *timers;
+
+    /**
+     * Worker threads for SNS_EVHANDLER_THREAD_POOL handlers, or zero
+     * for one per online CPU.  Never more than the pooled handlers.
+     */
+    size_t pool_threads;
+
+    /**
+     * How the main thread waits on multiple channels.
+     */
+    enum sns_evhandle_backend backend;
+
+    /**
+     * If not NULL, the statistics of all handlers are published here
+     * as a struct sns_msg_evstats every stats_period.
+     */
+    ach_channel_t *stats_channel;
+
+    /**
+     * Period of statistics messages.
+     */
+    const struct timespec *stats_period;
+
+    /**
+     * Real-time settings for threads started by the loop, applied with
+     * sns_init_rt_thread(), or NULL for threads to inherit the policy
+     * and affinity of the calling thread.
+     */
+    const struct sns_init_rt_opts *rt;
+};
+
+/**
+ * Event loop with extended options.
+ *
+ * Same as sns_evhandle(), and also runs handlers on dedicated threads
+ * or a work-stealing pool according to sns_evhandler.thread.  The
+ * loop stops when sns_cx.shutdown is set, after which the other
+ * threads are canceled and joined.  Use cancel_sigs so that a signal
+ * wakes every thread.
+ *
+ * @return ACH_OK after shutdown, or ACH_EINVAL without starting if an
+ * SNS_EVHANDLER_COALESCE handler has no coalesce_handler
+ */
+enum ach_status ACH_WARN_UNUSED
+sns_evhandle_run( struct sns_evhandler *handlers,
+                  size_t n,
+                  const struct sns_evhandle_opts *opts );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SNS_LOGSTORE_H
+#define SNS_LOGSTORE_H
+
+/**
+ * @file  logstore.h
+ * @brief Rotating binary store of log messages
+ *
+ * The store is a directory of numbered segments.  Each segment has a
+ * data file of raw log frames, as received from the log channel, and
+ * an index file with one fixed-size entry per frame.  Readers map
+ * both files and binary search the index by time.
+ *
+ * Times in the store are when the writer received each message, on
+ * CLOCK_REALTIME.  The message's own time, on SNS_CLOCK, restarts at
+ * each boot and is only kept in the frame.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default size of a data file before rotating to the next segment.
+ */
+#define SNS_LOGSTORE_SEGMENT_SIZE (64*1024*1024)
+
+/**
+ * Delay of a message, relative to later ones, beyond which a time
+ * query may miss it.
+ */
+#define SNS_LOGSTORE_SKEW_NS 1000000000
+
+/**
+ * Header of an index file.
+ *
+ * The time range lets readers skip a segment without mapping it.  It
+ * is widened before entries are written, so it covers every entry,
+ * and min is after max in a segment with no entries.
+ */
+struct sns_logstore_index_header {
+    char magic[8];              ///< "SNSIDX2"
+    int64_t min_sec;            ///< earliest time, seconds portion
+    int64_t max_sec;            ///< latest time, seconds portion
+    uint32_t min_nsec;          ///< earliest time, nanoseconds portion
+    uint32_t max_nsec;          ///< latest time, nanoseconds portion
+};
+
+/**
+ * Index entry for one stored frame.
+ */
+struct sns_logstore_entry {
+    int64_t sec;                ///< receive time, seconds portion
+    int64_t max_sec;            ///< latest time in the segment up to here
+    uint32_t nsec;              ///< receive time, nanoseconds portion
+    uint32_t max_nsec;          ///< latest time, nanoseconds portion
+    uint64_t offset;            ///< offset of the frame in the data file
+    uint32_t size;              ///< octets in the frame
+    int32_t priority;           ///< log priority
+    int64_t pid;                ///< sending PID
+    char ident[SNS_IDENT_LEN];  ///< sending process name
+};
+
+/**
+ * Writer of a store.
+ */
+struct sns_logstore {
+    char *dir;                  ///< store directory
+    size_t segment_size;        ///< data size to rotate at
+    size_t keep;                ///< segments to keep, or zero for all
+    uint64_t segment;           ///< current segment number
+    int fd_data;                ///< current data file
+    int fd_index;               ///< current index file
+    uint64_t data_size;         ///< octets in the data file
+    uint64_t index_size;        ///< octets in the index file
+    struct timespec min;        ///< earliest time in the segment
+    struct timespec max;        ///< latest time in the segment
+};
+
+/**
+ * Open a store for writing, creating dir if needed.
+ *
+ * Writing starts in a new segment after any existing ones.
+ *
+ * @param[out] store        the store
+ * @param[in]  dir          the store directory
+ * @param[in]  segment_size data size to rotate at, or zero for
+ *                          SNS_LOGSTORE_SEGMENT_SIZE
+ * @param[in]  keep         segments to keep, deleting older ones,
+ *                          or zero to keep all
+ *
+ * @return 0 on success, or -1 with errno set
+ */
+int
+sns_logstore_open( struct sns_logstore *store, const char *dir,
+                   size_t segment_size, size_t keep );
+
+/**
+ * Append log frames to the store.
+ *
+ * Frames are struct sns_msg_log or struct sns_msg_log_packed.
+ *
+ * @param[in] received the CLOCK_REALTIME receive time of each frame,
+ *                     or NULL for the current time
+ *
+ * @return 0 on success, or -1 with errno set.  On failure, frames
+ *         of the failed write are not stored.
+ */
+int
+sns_logstore_append( struct sns_logstore *store, size_t n,
+                     const void *const *frames, const size_t *sizes,
+                     const struct timespec *received );
+
+/**
+ * Close the store.
+ */
+void
+sns_logstore_close( struct sns_logstore *store );
+
+/**
+ * A mapped segment of a store.
+ */
+struct sns_logstore_segment {
+    const uint8_t *data;                      ///< the data file
+    size_t data_size;                         ///< octets in data
+    const struct sns_logstore_entry *index;   ///< index entries
+    size_t n;                                 ///< number of entries
+    void *index_map;                          ///< mapping of the index file
+    size_t index_map_size;                    ///< octets in index_map
+};
+
+/**
+ * List the segment numbers of a store in increasing order.
+ *
+ * @param[in]  dir      the store directory
+ * @param[out] segments the segment numbers, free with free()
+ *
+ * @return the number of segments, or -1 with errno set
+ */
+ssize_t
+sns_logstore_list( const char *dir, uint64_t **segments );
+
+/**
+ * Read the time range of a segment from its index header.
+ *
+ * @return 1 if the segment has entries, 0 if it is empty, or -1 with
+ *         errno set
+ */
+int
+sns_logstore_range( const char *dir, uint64_t segment,
+                    struct timespec *min, struct timespec *max );
+
+/**
+ * Map a segment for reading.
+ *
+ * The index ends before the first entry whose frame is not a whole
+ * message within the data file, e.g., from an interrupted write.
+ * Frame offsets only increase, so the end is found by binary search
+ * rather than by checking every entry.
+ *
+ * @return 0 on success, or -1 with errno set
+ */
+int
+sns_logstore_map( struct sns_logstore_segment *seg, const char *dir,
+                  uint64_t segment );
+
+/**
+ * Unmap a segment.
+ */
+void
+sns_logstore_unmap( struct sns_logstore_segment *seg );
+
+/**
+ * Find the first entry that may be at or after time.
+ *
+ * Entries before the result are all earlier than time.  Entries
+ * after it are in arrival order, which is in time order up to
+ * SNS_LOGSTORE_SKEW_NS.  There is no order between segments, since
+ * the clock may step back between runs of the writer.
+ */
+size_t
+sns_logstore_find( const struct sns_logstore_segment *seg,
+                   const struct timespec *time );
+
+/**
+ * Get the frame of an index entry.
+ */
+static inline const void *
+sns_logstore_frame( const struct sns_logstore_segment *seg,
+                    const struct sns_logstore_entry *e )
+{
+    return seg->data + e->offset;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*SNS_LOGSTORE_H*/
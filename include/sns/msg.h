@@ -110,6 +110,8 @@ typedef struct sns_msg_header {
     uint32_t n;               ///< Element count for variable-sized messages
     int64_t from_pid;         ///< Sending PID
     uint64_t seq;             ///< Sequence number
+    uint32_t flags;           ///< Encoding of the frame, SNS_MSG_FLAG_* bits
+    uint32_t reserved;        ///< Zero
     /**
      * Sending Host
      */
@@ -120,6 +122,12 @@ typedef struct sns_msg_header {
     char ident[SNS_IDENT_LEN];
 } sns_msg_header_t;
 
+/** The frame is a struct sns_msg_batch */
+#define SNS_MSG_FLAG_BATCH 0x1
+
+/** The frame is a single-precision (_f32) variant of its message type */
+#define SNS_MSG_FLAG_F32 0x2
+
 /**
  * Check if the message has expired.
  *
@@ -162,12 +170,218 @@ sns_msg_get_time( struct sns_msg_header *msg )
 /**
  * Set message header metadata
  *
- * @post the members of msg are initialized
+ * Copies the process's pid, host, and ident from a template.  Other
+ * members are left as they are; sns_msg_put() stamps the sequence
+ * number and, if unset, the send time.
+ *
+ * @post the sender members of msg are initialized
  *
  * @param[out] msg An SNS message
  */
 void sns_msg_header_fill ( struct sns_msg_header *msg );
 
+/**
+ * Put a message to a channel, stamping its sequence number.
+ *
+ * Sequence numbers increase by one for each message this process
+ * puts to the same channel, through any handle.  The send time is
+ * also stamped if the message time is unset (zero).
+ *
+ * @param[in]     chan  the channel to put to
+ * @param[in,out] msg   header of the message to put
+ * @param[in]     size  size of the message
+ */
+enum ach_status
+sns_msg_put( ach_channel_t *chan, struct sns_msg_header *msg, size_t size );
+
+/**
+ * Reserve the next sequence number for a channel.
+ *
+ * sns_msg_put() calls this for each message.
+ *
+ * @return the sequence number, or 0 (unsequenced) once this process
+ *         has sequenced more than 256 channels
+ */
+uint64_t
+sns_msg_seq_next( ach_channel_t *chan );
+
+/**
+ * Number of senders a struct sns_msg_tracker follows at once.
+ */
+#define SNS_MSG_TRACKER_SENDERS 8
+
+/**
+ * Sequence and latency statistics for received messages.
+ *
+ * Sequence numbers are followed per sending process, so channels
+ * with several writers, e.g., the log channel, are tracked correctly
+ * up to SNS_MSG_TRACKER_SENDERS writers.
+ */
+struct sns_msg_tracker {
+    /**
+     * Recent senders, each sequenced separately.
+     */
+    struct {
+        int64_t pid;          ///< sending process
+        uint64_t last_seq;    ///< highest sequence number from pid
+    } sender[SNS_MSG_TRACKER_SENDERS];
+    size_t next_sender;       ///< slot to reuse for a new sender
+
+    uint64_t received;        ///< messages seen
+    uint64_t unsequenced;     ///< messages without a sequence number
+    uint64_t senders;         ///< new senders, or ones forgotten since
+    uint64_t gaps;            ///< times one or more messages were skipped
+    uint64_t lost;            ///< total messages skipped
+    uint64_t reordered;       ///< messages older than the last one
+    uint64_t duplicates;      ///< messages repeating the last sequence number
+
+    int64_t latency_min_ns;   ///< smallest latency, now minus header time
+    int64_t latency_max_ns;   ///< largest latency
+    int64_t latency_sum_ns;   ///< sum of latencies, for the mean
+};
+
+/**
+ * Initialize a message tracker.
+ */
+void sns_msg_tracker_init( struct sns_msg_tracker *tracker );
+
+/**
+ * Account for a received message.
+ *
+ * @param[in,out] tracker  the tracker
+ * @param[in]     msg      header of the received message
+ * @param[in]     now      the current time, or NULL to read the clock
+ */
+void sns_msg_tracker_update( struct sns_msg_tracker *tracker,
+                             const struct sns_msg_header *msg,
+                             const struct timespec *now );
+
+/**
+ * Log the tracker statistics at the given priority.
+ */
+void sns_msg_tracker_log( const struct sns_msg_tracker *tracker,
+                          int priority, const char *name );
+
+/*---- Batches ----*/
+
+/** Identifies a batch frame, in addition to SNS_MSG_FLAG_BATCH */
+#define SNS_MSG_BATCH_MAGIC 0x48435442 /* "BTCH" */
+
+/**
+ * A frame carrying several complete messages.
+ *
+ * Batch frames have SNS_MSG_FLAG_BATCH set in the header, so that no
+ * other message is ever taken for a batch.
+ * Each sub-message is preceded by a struct sns_msg_batch_entry and
+ * padded to a multiple of SNS_MSG_BATCH_ALIGN bytes.
+ */
+struct sns_msg_batch {
+    struct sns_msg_header header;   ///< header.n is the sub-message count
+    uint32_t magic;                 ///< SNS_MSG_BATCH_MAGIC
+    uint32_t size;                  ///< bytes of data
+    uint8_t data[1];                ///< the sub-messages
+};
+
+/** Prefix of each sub-message in a batch */
+struct sns_msg_batch_entry {
+    uint64_t size;                  ///< size of the following message
+};
+
+/** Alignment of sub-messages in a batch */
+#define SNS_MSG_BATCH_ALIGN 8
+
+/** Size of a batch frame without any sub-messages */
+#define SNS_MSG_BATCH_SIZE_0 (offsetof(struct sns_msg_batch, data))
+
+/**
+ * Check whether a received frame is flagged as a batch.
+ */
+static inline int
+sns_msg_is_batch( const void *buf, size_t frame_size )
+{
+    return frame_size >= sizeof(struct sns_msg_header) &&
+        (((const struct sns_msg_header*)buf)->flags & SNS_MSG_FLAG_BATCH);
+}
+
+/**
+ * Check whether a received frame is a well-formed batch.
+ */
+int
+sns_msg_batch_check( const void *buf, size_t frame_size );
+
+/**
+ * Iterate over the sub-messages of a batch.
+ *
+ * @pre batch passed sns_msg_batch_check()
+ *
+ * @param[in]     batch   the batch
+ * @param[in,out] offset  iteration state, initially zero
+ * @param[out]    size    size of the returned sub-message
+ *
+ * @return the next sub-message, or NULL when done
+ */
+const struct sns_msg_header *
+sns_msg_batch_next( const struct sns_msg_batch *batch, size_t *offset, size_t *size );
+
+/**
+ * Accumulates messages into batch frames for a channel.
+ */
+struct sns_msg_batcher {
+    ach_channel_t *chan;            ///< channel to put batches to
+    struct sns_msg_batch *batch;    ///< batch being filled
+    size_t capacity;                ///< maximum frame size
+    int64_t max_delay_ns;           ///< flush this long after the first add
+    struct timespec deadline;       ///< when the current batch must be sent
+};
+
+/**
+ * Initialize a batcher.
+ *
+ * @param[out] b             the batcher
+ * @param[in]  chan          channel to put batches to
+ * @param[in]  capacity      maximum batch frame size in bytes
+ * @param[in]  max_delay_ns  longest a message may wait in the batch,
+ *                           or negative for no deadline
+ */
+void
+sns_msg_batcher_init( struct sns_msg_batcher *b, ach_channel_t *chan,
+                      size_t capacity, int64_t max_delay_ns );
+
+/**
+ * Free a batcher without flushing it.
+ */
+void
+sns_msg_batcher_destroy( struct sns_msg_batcher *b );
+
+/**
+ * Append a message to the batch.
+ *
+ * The pending batch is flushed first if msg would not fit, and after
+ * appending if the deadline has passed.  Messages too large for any
+ * batch are put directly.  Sequence numbers are stamped on each
+ * sub-message, and the time if unset.
+ */
+enum ach_status
+sns_msg_batcher_add( struct sns_msg_batcher *b,
+                     struct sns_msg_header *msg, size_t size );
+
+/**
+ * Put the pending batch, if any.
+ */
+enum ach_status
+sns_msg_batcher_flush( struct sns_msg_batcher *b );
+
+/**
+ * Flush the pending batch if its deadline has passed.
+ *
+ * Call this periodically, e.g., from the sns_evhandle() periodic
+ * handler, so that a quiet producer still sends on time.
+ *
+ * @param[in] now the current time, or NULL to use sns_time_get()
+ */
+enum ach_status
+sns_msg_batcher_poll( struct sns_msg_batcher *b, const struct timespec *now );
+
 /* True if frame_size is too small */
 
 /**
@@ -226,11 +440,133 @@ sns_msg_region_get( ach_channel_t *chan, struct aa_mem_region *region,
                     const struct timespec *ACH_RESTRICT abstime,
                     int options );
 
+/**
+ * Persistent receive buffer for a channel.
+ *
+ * The buffer grows to the largest frame seen on the channel and is
+ * then reused, so steady-state receives are a single copy out of the
+ * channel with no memory allocation.
+ */
+struct sns_msg_recv {
+    ach_channel_t *chan;   ///< the channel to receive from
+    void *buf;             ///< the receive buffer
+    size_t size;           ///< allocated size of buf
+};
+
+/**
+ * Initialize a receive buffer.
+ *
+ * @param[out] recv       the receive buffer
+ * @param[in]  chan       the channel to receive from
+ * @param[in]  size_hint  initial buffer size, e.g., the expected
+ *                        largest frame, or zero
+ */
+void
+sns_msg_recv_init( struct sns_msg_recv *recv, ach_channel_t *chan,
+                   size_t size_hint );
+
+/**
+ * Free a receive buffer.
+ */
+void
+sns_msg_recv_destroy( struct sns_msg_recv *recv );
+
+/**
+ * Read an ACH message into the receive buffer
+ *
+ * @post *pbuf points to the received frame.  It remains valid until
+ * the next call on recv.
+ *
+ * @param[in,out] recv        the receive buffer
+ * @param[out]    pbuf        pointer to the buffer pointer
+ * @param[out]    frame_size  size of the received message
+ * @param[in]     abstime     timeout for ach_get()
+ * @param[in]     options     options for ach_get()
+ */
+enum ach_status
+sns_msg_recv_get( struct sns_msg_recv *recv, void **pbuf,
+                  size_t *frame_size,
+                  const struct timespec *ACH_RESTRICT abstime,
+                  int options );
+
+/**
+ * A read-only view of a message frame in channel memory.
+ *
+ * Views are only valid until the sns_msg_view_fun that received
+ * them returns.
+ */
+struct sns_msg_view {
+    const void *buf;       ///< the frame, in channel memory
+    size_t frame_size;     ///< size of the frame
+    uint64_t generation;   ///< generation when the view was handed out
+};
+
+/**
+ * Callback to process a message in place.
+ *
+ * Return ACH_OK to accept the frame.  Any other value is returned
+ * from sns_msg_view_get().
+ */
+typedef enum ach_status
+sns_msg_view_fun( void *cx, const struct sns_msg_view *view );
+
+/**
+ * Read an ACH message in place, without copying it out of the channel
+ *
+ * @post fun was called with a view of the frame.  The view is
+ * released when fun returns.
+ *
+ * The channel stays locked while fun runs, so fun should be short,
+ * must not write to the same channel, and must copy (e.g., with
+ * sns_msg_view_copy()) anything it needs to keep.  Writers to the
+ * channel, including real-time ones, block until fun returns.
+ *
+ * @param[in]  chan        the channel from which the message is read
+ * @param[in]  fun         function called with a view of the frame
+ * @param[in]  cx          context argument for fun
+ * @param[out] frame_size  size of the received message
+ * @param[in]  abstime     timeout for ach_get()
+ * @param[in]  options     options for ach_get()
+ */
+enum ach_status
+sns_msg_view_get( ach_channel_t *chan,
+                  sns_msg_view_fun *fun, void *cx,
+                  size_t *frame_size,
+                  const struct timespec *ACH_RESTRICT abstime,
+                  int options );
+
+/**
+ * Check whether a view still refers to live channel memory.
+ *
+ * Views are invalidated when released and, conservatively, when the
+ * same thread obtains another view.
+ *
+ * @return true while the view may be read.
+ */
+int sns_msg_view_is_valid( const struct sns_msg_view *view );
+
+/**
+ * Copy a viewed message into the given memory region.
+ *
+ * @pre view is valid
+ *
+ * @return the copied frame, allocated from region
+ */
+void *sns_msg_view_copy( const struct sns_msg_view *view,
+                         struct aa_mem_region *region );
+
 /**
  * Define many functions for vararray messages
  *
  */
 #define SNS_DEF_MSG_VAR( type, var )                                    \
+    SNS_DEF_MSG_VAR_INIT( type, var, (void)0 )
+
+/**
+ * Define many functions for vararray messages, running statement init
+ * on msg in type ## _init() after the header is filled.
+ */
+#define SNS_DEF_MSG_VAR_INIT( type, var, init )                         \
     /* size_n */                                                        \
     /* Returns size (in octets) necessary to hold n items  */           \
     static inline uint32_t                                              \
@@ -271,6 +607,7 @@ sns_msg_region_get( ach_channel_t *chan, struct aa_mem_region *region,
         memset(msg, 0, type ## _size_n(n) );                            \
         sns_msg_header_fill( &msg->header );                            \
         msg->header.n = n;                                              \
+        init;                                                           \
     }                                                                   \
     /* alloc */                                                         \
     /* Allocate message in heat */                                      \
@@ -308,7 +645,7 @@ sns_msg_region_get( ach_channel_t *chan, struct aa_mem_region *region,
     type ## _put                                                        \
     ( ach_channel_t *chan, struct type *msg )                           \
     {                                                                   \
-        return ach_put( chan, msg, type ## _size(msg) );                \
+        return sns_msg_put( chan, &msg->header, type ## _size(msg) );   \
     }                                                                   \
     /* local_get */                                                     \
     /* Get message, allocated from local memory region */               \
@@ -322,8 +659,180 @@ sns_msg_region_get( ach_channel_t *chan, struct aa_mem_region *region,
         return  sns_msg_local_get ( chan,                               \
                                     (void**)pmsg, frame_size,           \
                                     abstime, options ) ;                \
+    }                                                                   \
+    /* view */                                                          \
+    /* Typed pointer to a viewed message, NULL if view is too small */  \
+    static inline const struct type*                                    \
+    type ## _view                                                       \
+    ( const struct sns_msg_view *view )                                 \
+    {                                                                   \
+        const struct type *msg = (const struct type *) view->buf;       \
+        if( view->frame_size < type ## _size_n(0) ||                    \
+            view->frame_size < type ## _size_n(msg->header.n) ) {       \
+            return NULL;                                                \
+        }                                                               \
+        return msg;                                                     \
     }
 
+/**********/
+/* SCHEMA */
+/**********/
+
+/**
+ * Scalar types of message fields
+ */
+enum sns_msg_scalar {
+    SNS_MSG_SCALAR_DOUBLE = 1,   ///< double
+    SNS_MSG_SCALAR_FLOAT,        ///< float
+    SNS_MSG_SCALAR_INT,          ///< int, including enums
+    SNS_MSG_SCALAR_INT64,        ///< int64_t
+    SNS_MSG_SCALAR_UINT64,       ///< uint64_t
+    SNS_MSG_SCALAR_UINT16,       ///< uint16_t
+    SNS_MSG_SCALAR_CHAR          ///< char, printed as text
+};
+
+/**
+ * Flag for fields that are part of a message's sample, e.g., for
+ * plotting or recording.
+ */
+#define SNS_MSG_FIELD_SAMPLE 0x01
+
+/**
+ * Descriptor for one field of a message.
+ */
+struct sns_msg_field {
+    const char *name;             ///< field name, NULL terminates a field list
+    enum sns_msg_scalar scalar;   ///< scalar type
+    size_t offset;                ///< offset from start of message or element
+    size_t count;                 ///< number of scalars in the field
+    int flags;                    ///< bitwise or of SNS_MSG_FIELD_ flags
+};
+
+/**
+ * Descriptor for the layout of a message type.
+ */
+struct sns_msg_schema {
+    const char *name;                    ///< short type name, e.g., "motor_ref"
+    size_t var_offset;                   ///< offset of the variable array
+    size_t elt_size;                     ///< size of each variable array element
+    const struct sns_msg_field *fixed;   ///< fields after the header, may be NULL
+    const struct sns_msg_field *elt;     ///< fields of each variable array element
+};
+
+/**
+ * Describe a fixed (non-array) field of a message.
+ */
+#define SNS_MSG_FIELD( type, member, scalar, count, flags )             \
+    { #member, scalar, offsetof(struct type, member), count, flags }
+
+/**
+ * Describe a member of the variable array elements of a message.
+ */
+#define SNS_MSG_ELT_FIELD( type, var, member, name, scalar, count, flags ) \
+    { name, scalar,                                                     \
+      offsetof(struct type, var[0].member) - offsetof(struct type, var), \
+      count, flags }
+
+/**
+ * Describe variable array elements that are themselves scalars.
+ */
+#define SNS_MSG_ELT_SCALAR( type, var, scalar, flags )  \
+    { #var, scalar, 0, 1, flags }
+
+/**
+ * Terminate a list of field descriptors.
+ */
+#define SNS_MSG_FIELD_END { NULL, (enum sns_msg_scalar)0, 0, 0, 0 }
+
+/**
+ * Define the schema for a message type.
+ *
+ * @param type   the message struct name
+ * @param var    the variable array member
+ * @param fixed  field list for the fixed fields, or NULL
+ * @param elt    field list for the variable array elements
+ */
+#define SNS_DEF_MSG_SCHEMA( type, var, fixed, elt )                     \
+    const struct sns_msg_schema type ## _schema = {                     \
+        #type + sizeof("sns_msg_") - 1,                                 \
+        offsetof(struct type, var),                                     \
+        sizeof(((struct type*)0)->var[0]),                              \
+        fixed, elt }
+
+/**
+ * Print a message using its schema.
+ */
+void sns_msg_schema_dump( FILE *out, const struct sns_msg_schema *schema,
+                          const void *msg );
+
+/**
+ * Generate a plot sample for a message using its schema.
+ *
+ * Samples and labels are allocated from the thread-local region.
+ *
+ * @see sns_msg_gather
+ */
+void sns_msg_schema_plot_sample( const struct sns_msg_schema *schema,
+                                 const void *msg,
+                                 double **sample_ptr, char ***sample_labels,
+                                 size_t *sample_size );
+
+/**
+ * Print a message header.
+ *
+ * @param[in] out   the output file
+ * @param[in] msg   the message header
+ * @param[in] type  type name to print
+ */
+void sns_msg_dump_header( FILE *out, const struct sns_msg_header *msg, const char *type );
+
+struct sns_msg_gather_run;
+
+/**
+ * Precomputed plan to flatten messages into arrays of doubles.
+ *
+ * The sample fields of the schema are grouped into runs of the same
+ * scalar type, so flattening is a strided copy with one branch per
+ * run rather than per field.
+ */
+struct sns_msg_gather {
+    const struct sns_msg_schema *schema;   ///< the message schema
+    size_t n_fixed;                        ///< samples from the fixed fields
+    size_t n_elt;                          ///< samples per array element
+    size_t n_run;                          ///< number of runs
+    struct sns_msg_gather_run *run;        ///< runs of same-typed scalars
+};
+
+/**
+ * Build the gather plan for a schema.
+ *
+ * @post plan is allocated from region
+ */
+void sns_msg_gather_init( struct sns_msg_gather *gather,
+                          const struct sns_msg_schema *schema,
+                          struct aa_mem_region *region );
+
+/**
+ * Number of samples produced for msg.
+ */
+size_t sns_msg_gather_size( const struct sns_msg_gather *gather, const void *msg );
+
+/**
+ * Flatten msg into sample.
+ *
+ * @param[in]  gather the gather plan
+ * @param[in]  msg    the message
+ * @param[out] sample array of at least sns_msg_gather_size() doubles
+ */
+void sns_msg_gather( const struct sns_msg_gather *gather, const void *msg,
+                     double *sample );
+
+/**
+ * Labels for the samples of msg, allocated from region.
+ */
+char **sns_msg_gather_labels( const struct sns_msg_gather *gather, const void *msg,
+                              struct aa_mem_region *region );
+
 /**
  * Declare plugin functions for message type
  */
@@ -334,7 +843,8 @@ sns_msg_region_get( ach_channel_t *chan, struct aa_mem_region *region,
         const struct type *msg,                                         \
         double **sample_ptr,                                            \
         char ***sample_labels,                                          \
-        size_t *sample_size );
+        size_t *sample_size );                                          \
+    extern const struct sns_msg_schema type ## _schema;
 
 /*******/
 /* LOG */
@@ -368,6 +878,57 @@ SNS_DEF_MSG_VAR( sns_msg_log, text );
  */
 SNS_DEC_MSG_PLUGINS( sns_msg_log );
 
+/**
+ * Flag in the priority of a struct sns_msg_log_packed.
+ */
+#define SNS_LOG_PACKED 0x40000000
+
+/**
+ * Log message to be formatted by the reader.
+ *
+ * Sent on the log channel alongside struct sns_msg_log; the priority
+ * is at the same offset and has SNS_LOG_PACKED set.
+ */
+typedef struct sns_msg_log_packed {
+    /**
+     * Message header.
+     */
+    struct sns_msg_header header;
+    /**
+     * Log priority, or'ed with SNS_LOG_PACKED
+     */
+    int priority;
+    /**
+     * Octets of the format string at the start of data, including
+     * the terminator.
+     */
+    uint32_t fmt_size;
+    /**
+     * The format string followed by arguments from sns_log_pack().
+     */
+    uint8_t data[1];
+} sns_msg_log_packed_t;
+
+/**
+ * Declare message functions.
+ */
+SNS_DEF_MSG_VAR( sns_msg_log_packed, data );
+
+/**
+ * Get the text of a log message, either struct sns_msg_log or struct
+ * sns_msg_log_packed.
+ *
+ * Packed messages are rendered into the thread-local memory region.
+ *
+ * @param[in]  buf        the received frame
+ * @param[in]  frame_size octets in the frame
+ * @param[out] priority   the log priority, without SNS_LOG_PACKED
+ *
+ * @return the null-terminated text, or NULL if the frame is invalid
+ */
+const char *
+sns_msg_log_text( const void *buf, size_t frame_size, int *priority );
+
 /**********/
 /* Vector */
 /**********/
@@ -395,6 +956,29 @@ SNS_DEF_MSG_VAR( sns_msg_vector, x );
  */
 SNS_DEC_MSG_PLUGINS( sns_msg_vector );
 
+/**
+ * Single-precision floating point vector.
+ */
+struct sns_msg_vector_f32 {
+    /**
+     * Message header
+     */
+    struct sns_msg_header header;
+    /**
+     * vector elements
+     */
+    float x[1];
+};
+
+/**
+ * Declare message functions.
+ */
+SNS_DEF_MSG_VAR_INIT( sns_msg_vector_f32, x, msg->header.flags |= SNS_MSG_FLAG_F32 );
+/**
+ * Declare message plugin functions.
+ */
+SNS_DEC_MSG_PLUGINS( sns_msg_vector_f32 );
+
 
 /**********/
 /* Matrix */
@@ -558,6 +1142,33 @@ SNS_DEF_MSG_VAR( sns_msg_motor_ref, u );
  */
 SNS_DEC_MSG_PLUGINS( sns_msg_motor_ref );
 
+/**
+ * Single-precision motor commands
+ */
+struct sns_msg_motor_ref_f32 {
+    /**
+     * The message header
+     */
+    struct sns_msg_header header;
+    /**
+     * The type of command
+     */
+    enum sns_motor_mode mode;
+    /**
+     * The commanded values
+     */
+    float u[1];
+};
+
+/**
+ * Declare message functions.
+ */
+SNS_DEF_MSG_VAR_INIT( sns_msg_motor_ref_f32, u, msg->header.flags |= SNS_MSG_FLAG_F32 );
+/**
+ * Declare message plugin functions.
+ */
+SNS_DEC_MSG_PLUGINS( sns_msg_motor_ref_f32 );
+
 /**
  * Message type for tagged motor commands
  */
@@ -632,6 +1243,42 @@ SNS_DEF_MSG_VAR( sns_msg_motor_state, X );
  */
 SNS_DEC_MSG_PLUGINS( sns_msg_motor_state );
 
+/**
+ * Single-precision motor state
+ */
+struct sns_msg_motor_state_f32 {
+    /**
+     * The message header
+     */
+    struct sns_msg_header header;
+    /**
+     * The current mode of the motor
+     */
+    enum sns_motor_mode mode;
+    /**
+     * Array of motor state
+     */
+    struct {
+        /**
+         * The motor position
+         */
+        float pos;
+        /**
+         * The motor velocity
+         */
+        float vel;
+    } X[1];
+};
+
+/**
+ * Declare message functions.
+ */
+SNS_DEF_MSG_VAR_INIT( sns_msg_motor_state_f32, X, msg->header.flags |= SNS_MSG_FLAG_F32 );
+/**
+ * Declare message plugin functions.
+ */
+SNS_DEC_MSG_PLUGINS( sns_msg_motor_state_f32 );
+
 /************/
 /* JOYSTICK */
 /************/
@@ -663,6 +1310,88 @@ SNS_DEF_MSG_VAR( sns_msg_joystick, axis );
  */
 SNS_DEC_MSG_PLUGINS( sns_msg_joystick );
 
+/**************/
+/* STATISTICS */
+/**************/
+
+/**
+ * Counters for one event handler.
+ *
+ * @see sns_evhandler
+ */
+struct sns_evstats {
+    uint64_t frames;                          ///< frames received
+    uint64_t missed;                          ///< receives that skipped frames
+    uint64_t bytes;                           ///< bytes received
+    uint64_t messages;                        ///< messages passed to the handler
+    int64_t runtime_max_ns;                   ///< longest handler call
+    int64_t latency_max_ns;                   ///< largest latency, dispatch minus header time
+    uint64_t runtime_hist[SNS_HIST_BINS];     ///< handler call durations
+    uint64_t latency_hist[SNS_HIST_BINS];     ///< latencies
+};
+
+/**
+ * Message type for event handler statistics, one element per handler.
+ */
+struct sns_msg_evstats {
+    /**
+     * The message header
+     */
+    struct sns_msg_header header;
+    /**
+     * Statistics of each handler
+     */
+    struct sns_evstats stats[1];
+};
+
+/**
+ * Declare message functions.
+ */
+SNS_DEF_MSG_VAR( sns_msg_evstats, stats );
+/**
+ * Declare message plugin functions.
+ */
+SNS_DEC_MSG_PLUGINS( sns_msg_evstats );
+
+/********************/
+/* SINGLE PRECISION */
+/********************/
+
+/**
+ * Convert n floats to doubles.
+ */
+void sns_real_widen( size_t n, const float *ACH_RESTRICT src, double *ACH_RESTRICT dst );
+
+/**
+ * Convert n doubles to floats, rounding to nearest.
+ */
+void sns_real_narrow( size_t n, const double *ACH_RESTRICT src, float *ACH_RESTRICT dst );
+
+/**
+ * Declare conversions between a message type and its single-precision
+ * variant.
+ *
+ * type ## _from_f32() and type ## _to_f32() copy the header, setting
+ * or clearing SNS_MSG_FLAG_F32, and convert the elements; dst must
+ * have room for src->header.n elements.
+ *
+ * type ## _accept() takes a received frame of either precision, as
+ * given by SNS_MSG_FLAG_F32.  A double-precision frame is returned as
+ * is; a single-precision frame is widened into a copy in the
+ * thread-local memory region.  Returns NULL if the frame is too short
+ * for header.n elements.
+ */
+#define SNS_DEC_MSG_F32( type )                                         \
+    void type ## _from_f32( struct type *dst,                           \
+                            const struct type ## _f32 *src );           \
+    void type ## _to_f32( struct type ## _f32 *dst,                    \
+                          const struct type *src );                     \
+    struct type *type ## _accept( void *buf, size_t frame_size )
+
+SNS_DEC_MSG_F32( sns_msg_vector );
+SNS_DEC_MSG_F32( sns_msg_motor_ref );
+SNS_DEC_MSG_F32( sns_msg_motor_state );
+
 /*************************/
 /* CONVENIENCE FUNCTIONS */
 /*************************/
@@ -684,13 +1413,153 @@ typedef void sns_msg_dump_fun( FILE *, void* );
  */
 typedef void sns_msg_plot_sample_fun( const void *, double **, char ***, size_t *);
 
-// TODO: message validation
+/**************/
+/* VALIDATION */
+/**************/
+
+/**
+ * Reasons a message fails validation
+ */
+enum sns_msg_invalid {
+    SNS_MSG_VALID = 0,              ///< message is valid
+    SNS_MSG_INVALID_SIZE,           ///< frame too small for header.n
+    SNS_MSG_INVALID_TIME,           ///< malformed or too old timestamp
+    SNS_MSG_INVALID_STRING,         ///< unterminated host or ident
+    SNS_MSG_INVALID_NONFINITE,      ///< NaN or infinite value
+    SNS_MSG_INVALID_RANGE,          ///< value outside [min,max]
+    SNS_MSG_INVALID_MAX             ///< number of reasons
+};
+
+/**
+ * Describe a validation result.
+ */
+const char *sns_msg_invalid_string( enum sns_msg_invalid r );
+
+/**
+ * Check the header of a received frame.
+ *
+ * @param[in] msg         the frame
+ * @param[in] frame_size  size of the frame
+ * @param[in] schema      layout used to check header.n against
+ *                        frame_size, or NULL
+ */
+enum sns_msg_invalid
+sns_msg_validate_header( const struct sns_msg_header *msg, size_t frame_size,
+                         const struct sns_msg_schema *schema );
+
+/**
+ * Check that n doubles are finite and within [min,max].
+ */
+enum sns_msg_invalid
+sns_real_validate( size_t n, const double *x, double min, double max );
+
+/**
+ * Check that n floats are finite and within [min,max].
+ */
+enum sns_msg_invalid
+sns_real_f32_validate( size_t n, const float *x, double min, double max );
+
+/**
+ * Validation settings and per-channel counts.
+ */
+struct sns_msg_validator {
+    const struct sns_msg_schema *schema;  ///< message layout, or NULL to check only the header
+    double min;                           ///< smallest allowed floating point value
+    double max;                           ///< largest allowed floating point value
+    int64_t max_age_ns;                   ///< oldest allowed message, or negative to allow any
+
+    uint64_t checked;                     ///< messages checked
+    uint64_t rejected[SNS_MSG_INVALID_MAX]; ///< rejected messages by reason
+};
+
+/**
+ * Initialize a validator with no range or age limits.
+ */
+void sns_msg_validator_init( struct sns_msg_validator *v,
+                             const struct sns_msg_schema *schema );
+
+/**
+ * Validate a received frame and count the result.
+ *
+ * Checks the header, then every floating point field of the schema
+ * for NaN, infinity, and values outside [min,max].
+ */
+enum sns_msg_invalid
+sns_msg_validate( struct sns_msg_validator *v, const void *msg, size_t frame_size );
+
+/**
+ * Log the validation counts.
+ */
+void sns_msg_validator_log( const struct sns_msg_validator *v,
+                            int priority, const char *name );
 
 /**
  * Load symbol from message plugin
+ *
+ * @see sns_msg_type_lookup
  */
 void *sns_msg_plugin_symbol( const char *type, const char *symbol );
 
+/**
+ * Description of a message type
+ */
+struct sns_msg_type {
+    const char *name;                      ///< type name, e.g., "motor_ref"
+    size_t size_0;                         ///< size of a message with no elements
+    size_t elt_size;                       ///< size of each variable-array element
+    size_t header_offset;                  ///< offset of the struct sns_msg_header
+    sns_msg_dump_fun *dump;                ///< print a message, may be NULL
+    sns_msg_plot_sample_fun *plot_sample;  ///< sample a message for plotting, may be NULL
+    const struct sns_msg_schema *schema;   ///< message layout, may be NULL
+};
+
+/**
+ * Find a message type by name.
+ *
+ * Types built into libsns and types added with
+ * sns_msg_type_register() are found in a hash table.  Other types are
+ * loaded from the plugin library libsns_msg_<name>.so, whose sizes
+ * are then unknown (zero).
+ *
+ * @param[in] name the type name, with or without the "sns_msg_" prefix
+ *
+ * @return the type, or NULL if it is unknown
+ */
+const struct sns_msg_type *sns_msg_type_lookup( const char *name );
+
+/**
+ * Add an out-of-tree message type to the registry.
+ *
+ * @param[in] type the type description, which must outlive its use
+ *
+ * @return zero on success, nonzero if a type with the same name exists
+ */
+int sns_msg_type_register( const struct sns_msg_type *type );
+
+/**
+ * Define the entry points of a plugin library for an out-of-tree
+ * message type.
+ *
+ * Build a library libsns_msg_<name>.so containing
+ * SNS_MSG_PLUGIN_DEFINE(type), where type##_dump and
+ * type##_plot_sample are declared with SNS_DEC_MSG_PLUGINS.
+ */
+#define SNS_MSG_PLUGIN_DEFINE(type)                                     \
+    void sns_msg_dump                                                   \
+    ( FILE *out, const void *msg )                                      \
+    {                                                                   \
+        type ## _dump( out, (const struct type*) msg );                 \
+    }                                                                   \
+                                                                        \
+    void sns_msg_plot_sample                                            \
+    ( const void *msg,                                                  \
+      double **sample_ptr, char ***sample_labels, size_t *sample_size ) \
+    {                                                                   \
+        type ## _plot_sample                                            \
+            ( (const struct type*)msg,                                  \
+              sample_ptr, sample_labels, sample_size );                 \
+    }
+
 /**
  * Declaration for the plugin dump function
  */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SNS_PERIODIC_H
+#define SNS_PERIODIC_H
+
+/**
+ * @file  periodic.h
+ * @brief Absolute-deadline periodic scheduling
+ *
+ * Release times lie on a fixed grid on SNS_CLOCK, so handler runtime
+ * and wakeup latency do not accumulate into drift.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * What to do when a cycle finishes after the next release
+ */
+enum sns_periodic_overrun {
+    /** Skip missed releases and resume at the next future one */
+    SNS_PERIODIC_SKIP = 0,
+    /** Run missed releases back to back until caught up */
+    SNS_PERIODIC_CATCH_UP
+};
+
+/**
+ * Number of histogram bins.
+ *
+ * @see SNS_HIST_BINS
+ */
+#define SNS_PERIODIC_HIST_BINS SNS_HIST_BINS
+
+/**
+ * Statistics for a periodic task.
+ *
+ * Updated with relaxed atomic operations by the scheduling thread, so
+ * other threads may read them without locking.
+ */
+struct sns_periodic_stats {
+    uint64_t cycles;                                ///< cycles run
+    uint64_t overruns;                              ///< cycles that ended after the next release
+    uint64_t skipped;                               ///< releases skipped after overruns
+    int64_t latency_max_ns;                         ///< worst release-to-start latency
+    int64_t exec_max_ns;                            ///< worst execution time
+    uint64_t latency_hist[SNS_PERIODIC_HIST_BINS];  ///< release-to-start latency
+    uint64_t exec_hist[SNS_PERIODIC_HIST_BINS];     ///< execution time
+};
+
+/**
+ * A periodic task's schedule and statistics.
+ */
+struct sns_periodic {
+    int64_t period_ns;                    ///< the period
+    enum sns_periodic_overrun overrun;    ///< overrun policy
+    struct timespec release;              ///< next release time
+    struct timespec start;                ///< start of the current cycle
+    struct sns_periodic_stats stats;      ///< statistics
+};
+
+/**
+ * Initialize a periodic task.
+ *
+ * The first release is one period from now.
+ */
+void sns_periodic_init( struct sns_periodic *p, const struct timespec *period,
+                        enum sns_periodic_overrun overrun );
+
+/**
+ * True if the task is released at time now.
+ */
+int sns_periodic_due( const struct sns_periodic *p, const struct timespec *now );
+
+/**
+ * Time from now until the next release, or zero if already released.
+ */
+struct timespec sns_periodic_remaining( const struct sns_periodic *p,
+                                        const struct timespec *now );
+
+/**
+ * Sleep until the next release.
+ *
+ * @return 0, or an errno value if interrupted
+ */
+int sns_periodic_wait( const struct sns_periodic *p );
+
+/**
+ * Mark the start of a cycle and record its latency.
+ */
+void sns_periodic_begin( struct sns_periodic *p, const struct timespec *now );
+
+/**
+ * Mark the end of a cycle, record its execution time, and advance
+ * the release time according to the overrun policy.
+ */
+void sns_periodic_end( struct sns_periodic *p, const struct timespec *now );
+
+/**
+ * Log the statistics, including latency and execution time
+ * percentiles estimated from the histograms.
+ */
+void sns_periodic_log( const struct sns_periodic *p, int priority, const char *name );
+
+
+/*--- Timer Wheel ---*/
+
+/**
+ * Number of slots in a timer wheel.
+ */
+#define SNS_TIMER_WHEEL_SLOTS 256
+
+/**
+ * A periodic task in a timer wheel.
+ */
+struct sns_timer {
+    const char *name;                            ///< name for logging
+    enum ach_status (*handler)(void *context);   ///< function to run
+    void *context;                               ///< context argument to handler
+    int priority;                                ///< higher runs first among timers due together
+    struct sns_periodic periodic;                ///< schedule and statistics
+    uint64_t tick;                               ///< wheel tick of the next release
+    struct sns_timer *next;                      ///< next timer in the slot or due list
+    struct sns_timer **prev;                     ///< link to this timer in its list
+};
+
+/**
+ * A hashed timer wheel scheduling many periodic tasks off one
+ * wakeup.
+ *
+ * Releases are rounded up to the wheel resolution.  Adding and
+ * removing timers is O(1).  Expiring jumps between ticks that have
+ * timers, scanning at most one revolution of slots for each, so its
+ * cost does not grow with the time since the last expire.
+ */
+struct sns_timer_wheel {
+    int64_t tick_ns;                                  ///< resolution
+    struct timespec epoch;                            ///< time of tick zero
+    uint64_t tick;                                    ///< next tick to expire
+    size_t n;                                         ///< number of timers
+    struct sns_timer *due;                            ///< timers of the tick being expired
+    struct sns_timer *running;                        ///< timer whose handler is running
+    struct sns_timer *slots[SNS_TIMER_WHEEL_SLOTS];   ///< timers by tick modulo slots
+};
+
+/**
+ * Initialize a timer.
+ *
+ * Releases are at phase plus multiples of period after the epoch of
+ * the wheel it is added to.  Missed releases are skipped; set
+ * t->periodic.overrun to change that.
+ *
+ * @param t        the timer
+ * @param name     name for logging
+ * @param period   period of the timer
+ * @param phase    offset of releases from the wheel epoch, or NULL for zero
+ * @param priority order among timers due together, higher first
+ * @param handler  function to run
+ * @param context  context argument to handler
+ */
+void sns_timer_init( struct sns_timer *t, const char *name,
+                     const struct timespec *period, const struct timespec *phase,
+                     int priority,
+                     enum ach_status (*handler)(void *context), void *context );
+
+/**
+ * Initialize a timer wheel.
+ *
+ * @param w          the wheel
+ * @param resolution duration of one tick
+ */
+void sns_timer_wheel_init( struct sns_timer_wheel *w, const struct timespec *resolution );
+
+/**
+ * Add a timer, first released at its next release after now.
+ */
+void sns_timer_wheel_add( struct sns_timer_wheel *w, struct sns_timer *t );
+
+/**
+ * Remove a timer.
+ *
+ * May be called from a timer handler, including for the running timer
+ * itself and for other timers due in the same tick.
+ */
+void sns_timer_wheel_remove( struct sns_timer_wheel *w, struct sns_timer *t );
+
+/**
+ * Find when the next timer is due.
+ *
+ * @param[out] when time of the next tick with a timer due
+ * @return 0 if the wheel is empty, 1 otherwise
+ */
+int sns_timer_wheel_next( const struct sns_timer_wheel *w, struct timespec *when );
+
+/**
+ * Run all timers due by now, in priority order within each tick.
+ *
+ * @return ACH_OK, or the first other status returned by a handler
+ */
+enum ach_status sns_timer_wheel_expire( struct sns_timer_wheel *w, const struct timespec *now );
+
+/**
+ * Log the statistics of every timer.
+ */
+void sns_timer_wheel_log( const struct sns_timer_wheel *w, int priority );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*SNS_PERIODIC_H*/
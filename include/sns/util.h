@@ -77,17 +77,82 @@ static inline struct timespec sns_time_add_ns( struct timespec ts, int64_t ns )
     return r;
 }
 
+/**
+ * Clock used for message timestamps, expiry checks, and sns_now().
+ *
+ * This is the same clock ach uses for timeouts, so message times can
+ * be compared directly against ach deadlines.
+ */
+#define SNS_CLOCK ACH_DEFAULT_CLOCK
+
 static inline
 struct timespec sns_now(void)
 {
-    /* TODO: CLOCK_MONOTONIC is machine local
+    /* TODO: SNS_CLOCK is machine local
      * Look into Precision Time Protocol
      */
     struct timespec t;
-    clock_gettime( CLOCK_MONOTONIC, &t );
+    clock_gettime( SNS_CLOCK, &t );
     return t;
 }
 
+/**
+ * Read SNS_CLOCK and cache the result for the calling thread.
+ *
+ * sns_evhandle() calls this once per wakeup so that all timestamps
+ * and expiry checks made while handling that wakeup agree.
+ */
+void sns_time_cache_update( void );
+
+/**
+ * Invalidate the calling thread's cached time.
+ */
+void sns_time_cache_clear( void );
+
+/**
+ * Get the current time.
+ *
+ * Returns the calling thread's cached time if valid, otherwise reads
+ * SNS_CLOCK.
+ *
+ * @return 0 on success, or -1 with errno set if the clock read failed
+ */
+int sns_time_get( struct timespec *now );
+
+/**
+ * Number of bins in a duration histogram.  Bin k counts durations in
+ * [2^(k-1), 2^k) nanoseconds; bin 0 counts zero and negative
+ * durations, and the last bin everything longer.
+ */
+#define SNS_HIST_BINS 32
+
+/**
+ * Add a duration to a histogram and update its maximum.
+ *
+ * Only one thread may update a histogram at a time.  Uses relaxed
+ * atomic loads and stores, so other threads may read the histogram
+ * while it is updated.
+ */
+void sns_hist_add( uint64_t *hist, int64_t *max_ns, int64_t ns );
+
+/**
+ * Estimate a quantile from a histogram.
+ *
+ * @return upper bound of the bin holding fraction q of the samples
+ */
+int64_t sns_hist_quantile( const uint64_t *hist, double q );
+
+struct iovec;
+
+/**
+ * Write all of a vector, retrying after short writes and EINTR.
+ *
+ * The vector is modified to skip what has been written.
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+int sns_writev_all( int fd, struct iovec *iov, int n_iov );
+
 const char *sns_str_nullterm( const char *text, size_t n );
 
 /**
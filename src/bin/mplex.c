@@ -35,6 +35,7 @@
 #include <poll.h>
 #include <sns.h>
 #include <ach/experimental.h>
+#include <sns/event.h>
 #include <getopt.h>
 
 
@@ -53,7 +54,7 @@ struct cx {
     size_t n;
 };
 
-enum ach_status handle( void *cx, struct ach_channel *channel );
+enum ach_status handle( void *cx, void *msg, size_t frame_size );
 enum ach_status periodic( void *cx );
 
 int main(int argc, char **argv)
@@ -115,21 +116,25 @@ int main(int argc, char **argv)
     sns_chan_open( &cx.out, opt_chan_out , NULL );
     cx.in = AA_NEW_AR(struct mplex_input, cx.n);
 
-    struct ach_evhandler *handlers = AA_NEW_AR( struct ach_evhandler, cx.n);
+    struct sns_evhandler *handlers = AA_NEW0_AR( struct sns_evhandler, cx.n);
 
     // Initialize arrays
     for( size_t j = cx.n; j; j--) {
         size_t i = j-1;
 
         cx.in[i].name = (const char*)aa_mem_rlist_pop(names_list);
+        cx.in[i].msg = NULL;
+        cx.in[i].max = 0;
+        cx.in[i].updated = 0;
 
         // open channel
         sns_chan_open( &cx.in[i].channel, cx.in[i].name, NULL );
 
-        // init handler
+        // init handler, relaying only the newest message
         handlers[i].channel = &cx.in[i].channel;
         handlers[i].context = cx.in+i;
         handlers[i].handler = handle;
+        handlers[i].mode = SNS_EVHANDLER_LATEST;
 
         SNS_LOG(LOG_DEBUG, "Initialized input channel %s\n", cx.in[i].name );
     }
@@ -138,65 +143,60 @@ int main(int argc, char **argv)
 
     SNS_LOG( LOG_DEBUG, "Period: %09lu.%08ld\n",
              period.tv_sec, period.tv_nsec );
+
+    // Relay on input and on absolute releases, so the rate does not drift
+    struct sns_periodic sched;
+    sns_periodic_init( &sched, &period, SNS_PERIODIC_SKIP );
+
     // Run Loop
-    while( !sns_cx.shutdown) {
-        errno = 0;
-        enum ach_status r = ach_evhandle( handlers, cx.n,
-                                          &period, periodic, &cx,
-                                          ACH_EV_O_PERIODIC_INPUT );
-        if(sns_cx.shutdown) break;
-        SNS_REQUIRE( ACH_OK == r,
-                     "Could not handle events: %s, %s\n",
-                     ach_result_to_string(r),
-                     strerror(errno) );
+    struct sns_evhandle_opts opts;
+    memset( &opts, 0, sizeof(opts) );
+    opts.period = &period;
+    opts.periodic = &sched;
+    opts.periodic_handler = periodic;
+    opts.periodic_context = &cx;
+    opts.cancel_sigs = sns_sig_term_default;
+    opts.options = ACH_EV_O_PERIODIC_INPUT | ACH_EV_O_PERIODIC_TIMEOUT;
+    // epoll only helps when it can wait on the channels directly
+    opts.backend = SNS_EVHANDLE_BACKEND_EPOLL;
+    for( size_t i = 0; i < cx.n; i ++ ) {
+        if( !sns_evhandle_pollable(&cx.in[i].channel) ) {
+            opts.backend = SNS_EVHANDLE_BACKEND_ACH;
+        }
     }
 
+    enum ach_status r = sns_evhandle_run( handlers, cx.n, &opts );
+    SNS_REQUIRE( ACH_OK == r,
+                 "Could not handle events: %s, %s\n",
+                 ach_result_to_string(r),
+                 strerror(errno) );
+
+    sns_periodic_log( &sched, LOG_DEBUG, "relay" );
+
     return 0;
 }
 
-enum ach_status handle( void *cx, struct ach_channel *channel )
+enum ach_status handle( void *cx, void *msg, size_t frame_size )
 {
     struct mplex_input *m = (struct mplex_input*)cx;
     SNS_LOG(LOG_DEBUG, "Event on channel %s\n", m->name );
 
-    if( ! m->msg ) {
-        // lazily allocate message
-        void *msg;
-        enum ach_status r = sns_msg_local_get( channel, &msg,
-                                               &m->frame_size, NULL, ACH_O_LAST );
-        if( ACH_STALE_FRAMES == r ) return r;
-        SNS_REQUIRE( (ACH_OK == r || ACH_MISSED_FRAME == r),
-                     "Could not get ach message on %s: %s\n",
-                     m->name, ach_result_to_string(r) );
-
-        if( m->frame_size < sizeof(struct sns_msg_header) ) {
-            SNS_LOG(LOG_ERR, "Invalid message size on channel %s\n", m->name);
-        } else {
-            m->msg = (struct sns_msg_header*)malloc(m->frame_size);
-            m->max = m->frame_size;
-            memcpy(m->msg, msg, m->frame_size);
-        }
-        m->updated = 1;
-        aa_mem_region_local_pop( msg );
-    } else {
-        enum ach_status r = ach_get( channel, m->msg, m->max,
-                                     &m->frame_size, NULL, ACH_O_LAST );
-        switch(r) {
-        case ACH_OK:
-        case ACH_MISSED_FRAME:
-            // got it
-            m->updated = 1;
-            break;
-        case ACH_STALE_FRAMES: return r;
-        case ACH_OVERFLOW:
-            // TODO: maybe handle this?
-            SNS_LOG(LOG_ERR, "Message overflow on channel %s\n", m->name);
-            break;
-        default:
-            SNS_DIE("Could not get message from channel %s: %s\n",
-                    m->name, ach_result_to_string(r) );
-        }
+    enum sns_msg_invalid v = sns_msg_validate_header( (struct sns_msg_header*)msg,
+                                                      frame_size, NULL );
+    if( SNS_MSG_VALID != v ) {
+        SNS_LOG(LOG_ERR, "Invalid message on channel %s: %s\n",
+                m->name, sns_msg_invalid_string(v));
+        return ACH_OK;
+    }
+
+    if( frame_size > m->max ) {
+        m->msg = (struct sns_msg_header*)realloc(m->msg, frame_size);
+        SNS_REQUIRE( m->msg, "Could not allocate message for %s\n", m->name );
+        m->max = frame_size;
     }
+    memcpy(m->msg, msg, frame_size);
+    m->frame_size = frame_size;
+    m->updated = 1;
 
     return ACH_OK;
 }
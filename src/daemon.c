@@ -49,12 +49,29 @@
 #include <signal.h>
 #include <sys/resource.h>
 #include <sched.h>
+#include <inttypes.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 struct sns_cx sns_cx = {0};
 
+/* Rebuild the template of sender members copied by sns_msg_header_fill() */
+static void header_template_update( void ) {
+    struct sns_msg_header *h = &sns_cx.header;
+    memset( h, 0, sizeof(*h) );
+    h->from_pid = sns_cx.pid;
+    memcpy( h->from_host, sns_cx.host, sizeof(h->from_host) );
+    if( sns_cx.ident ) {
+        strncpy( h->ident, sns_cx.ident, sizeof(h->ident) - 1 );
+    }
+}
+
 void sns_set_ident( const char * ident) {
     sns_cx.ident = ident;
+    header_template_update();
 }
 
 /* Redirection of stderr to sns log */
@@ -115,6 +132,7 @@ void sns_init( void ) {
 
     /* hostname */
     gethostname( sns_cx.host, SNS_HOSTNAME_LEN );
+    sns_cx.host[SNS_HOSTNAME_LEN-1] = '\0';
 
     /* log channel */
     sns_chan_open( &sns_cx.chan_log, SNS_LOG_CHANNEL, NULL );
@@ -144,6 +162,11 @@ void sns_init( void ) {
         sns_set_ident("sns");
     }
 
+    /* Log message encoding */
+    if( NULL != (ptr = getenv("SNS_LOG_PACKED")) ) {
+        sns_log_set_packed( '\0' != ptr[0] && strcmp(ptr, "0") );
+    }
+
     /* cd to tmp dir */
     /* This is where we may dump core */
     if( NULL != (ptr = getenv("SNS_TMPDIR")) ) {
@@ -172,49 +195,219 @@ void sns_init( void ) {
 }
 
 
-void sns_init_rt( const struct sns_init_rt_opts *opts )
+/*---- Real-time ----*/
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+#ifndef SCHED_FLAG_RESET_ON_FORK
+#define SCHED_FLAG_RESET_ON_FORK 0x01
+#endif
+
+/* Argument of the sched_setattr system call, which glibc may not wrap */
+struct rt_sched_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+static int rt_sched_deadline( const struct sns_init_rt_opts *opts )
 {
-    sns_init();
+#ifdef SYS_sched_setattr
+    struct rt_sched_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.size = sizeof(attr);
+    attr.sched_policy = SCHED_DEADLINE;
+    /* without it, creating a thread fails with EAGAIN */
+    attr.sched_flags = SCHED_FLAG_RESET_ON_FORK;
+    attr.sched_runtime = opts->dl_runtime_ns;
+    attr.sched_deadline = opts->dl_deadline_ns ? opts->dl_deadline_ns : opts->dl_period_ns;
+    attr.sched_period = opts->dl_period_ns;
+    if( syscall(SYS_sched_setattr, 0, &attr, 0) ) {
+        SNS_LOG( LOG_ERR, "Couldn't set SCHED_DEADLINE %"PRIu64"/%"PRIu64" ns: %s\n",
+                 opts->dl_runtime_ns, opts->dl_period_ns, strerror(errno) );
+        return 0;
+    }
+    return SNS_RT_SCHED;
+#else
+    (void)opts;
+    SNS_LOG( LOG_ERR, "SCHED_DEADLINE is not supported\n" );
+    return 0;
+#endif
+}
 
-    // set scheduling policy
-    {
-        int max = sched_get_priority_max( SCHED_RR );
-        int min = sched_get_priority_min( SCHED_RR );
-        if( max >= 0 && min >= 0 ) {
-            int pri = opts->prio;
-            if( pri > 0 && pri >= min ) {
-                struct sched_param sp;
-                /* 32 is max portable priority*/
-                if( pri > max ) {
-                    syslog(LOG_WARNING, "Requested priority %d exceeds max %d",
-                           pri, max);
-                    pri = max;
-                }
-                sp.sched_priority = pri;
-                if( sched_setscheduler( 0, SCHED_RR, &sp) < 0 ) {
-                    syslog(LOG_ERR, "Couldn't set scheduling priority to %d: %s\n",
-                           pri, strerror(errno) );
-                }
-            }
-        } else {
-            syslog(LOG_ERR, "Couldn't get scheduling priorities: %d, %d, %s\n",
-                   max, min, strerror(errno) );
+static int rt_sched( const struct sns_init_rt_opts *opts )
+{
+    int policy;
+    switch( opts->policy ) {
+    case SNS_SCHED_DEFAULT:
+        if( opts->prio <= 0 ) return 0;
+        policy = SCHED_RR;
+        break;
+    case SNS_SCHED_OTHER:
+        policy = SCHED_OTHER;
+        break;
+    case SNS_SCHED_FIFO:
+        policy = SCHED_FIFO;
+        break;
+    case SNS_SCHED_RR:
+        policy = SCHED_RR;
+        break;
+    case SNS_SCHED_DEADLINE:
+        return rt_sched_deadline( opts );
+    default:
+        SNS_LOG( LOG_ERR, "Unknown scheduling policy %d\n", opts->policy );
+        return 0;
+    }
+
+    struct sched_param sp;
+    memset( &sp, 0, sizeof(sp) );
+    if( SCHED_OTHER != policy ) {
+        int max = sched_get_priority_max( policy );
+        int min = sched_get_priority_min( policy );
+        if( max < 0 || min < 0 ) {
+            SNS_LOG( LOG_ERR, "Couldn't get scheduling priorities: %d, %d, %s\n",
+                     max, min, strerror(errno) );
+            return 0;
+        }
+        int pri = opts->prio;
+        if( pri < min ) {
+            SNS_LOG( LOG_WARNING, "Requested priority %d is below min %d\n", pri, min );
+            pri = min;
+        } else if( pri > max ) {
+            SNS_LOG( LOG_WARNING, "Requested priority %d exceeds max %d\n", pri, max );
+            pri = max;
         }
+        sp.sched_priority = pri;
+    }
+    if( sched_setscheduler(0, policy, &sp) < 0 ) {
+        SNS_LOG( LOG_ERR, "Couldn't set scheduling priority to %d: %s\n",
+                 sp.sched_priority, strerror(errno) );
+        return 0;
     }
+    return SNS_RT_SCHED;
+}
 
-    // lock memory, can't swap to disk
+static int rt_affinity( const struct sns_init_rt_opts *opts )
+{
+    if( NULL == opts->affinity ) return 0;
+    if( sched_setaffinity(0, sizeof(*opts->affinity), opts->affinity) ) {
+        SNS_LOG( LOG_ERR, "Couldn't set CPU affinity: %s\n", strerror(errno) );
+        return 0;
+    }
+    return SNS_RT_AFFINITY;
+}
 
-    char prefault[1024*256];
-    memset( prefault,0,sizeof(prefault) );
+/* Touch each page so that later accesses do not fault */
+static void rt_touch( void *ptr, size_t size )
+{
+    volatile uint8_t *p = (volatile uint8_t*)ptr;
+    long page = sysconf( _SC_PAGESIZE );
+    size_t step = page > 0 ? (size_t)page : 4096;
+    for( size_t i = 0; i < size; i += step ) p[i] = 0;
+    if( size ) p[size-1] = 0;
+}
+
+static __attribute__((noinline)) int rt_prefault_stack( size_t size )
+{
+    if( size > SNS_PREFAULT_STACK_MAX ) {
+        SNS_LOG( LOG_WARNING, "Limiting stack prefault of %lu bytes to %lu\n",
+                 (unsigned long)size, (unsigned long)SNS_PREFAULT_STACK_MAX );
+        size = SNS_PREFAULT_STACK_MAX;
+    }
+    uint8_t prefault[size];
+    rt_touch( prefault, size );
+    return SNS_RT_PREFAULT_STACK;
+}
+
+static int rt_prefault_heap( size_t size )
+{
+    if( 0 == size ) return 0;
+#ifdef __GLIBC__
+    /* Keep freed memory in the allocator rather than returning it */
+    if( !mallopt(M_TRIM_THRESHOLD, -1) || !mallopt(M_MMAP_MAX, 0) ) {
+        SNS_LOG( LOG_ERR, "Couldn't disable heap trimming\n" );
+        return 0;
+    }
+    void *ptr = malloc( size );
+    if( NULL == ptr ) {
+        SNS_LOG( LOG_ERR, "Couldn't allocate %lu bytes to prefault\n", (unsigned long)size );
+        return 0;
+    }
+    rt_touch( ptr, size );
+    free( ptr );
+    return SNS_RT_PREFAULT_HEAP;
+#else
+    SNS_LOG( LOG_ERR, "Heap prefaulting is not supported\n" );
+    return 0;
+#endif
+}
+
+static int rt_prefault_region( size_t size )
+{
+    if( 0 == size ) return 0;
+    /* Popping keeps the chunk, so the pages stay touched */
+    void *ptr = aa_mem_region_local_alloc( size );
+    rt_touch( ptr, size );
+    aa_mem_region_local_pop( ptr );
+    return SNS_RT_PREFAULT_REGION;
+}
+
+int sns_init_rt_thread( const struct sns_init_rt_opts *opts )
+{
+    int applied = 0;
+    /* Set affinity first; it cannot be changed under SCHED_DEADLINE */
+    applied |= rt_affinity( opts );
+    applied |= rt_sched( opts );
+    applied |= rt_prefault_stack( opts->prefault_stack ?
+                                  opts->prefault_stack : SNS_PREFAULT_STACK_DEFAULT );
+    applied |= rt_prefault_region( opts->prefault_region );
+    sns_log_async_thread_init();
+    return applied;
+}
+
+int sns_init_rt( const struct sns_init_rt_opts *opts )
+{
+    sns_init();
+
+    int applied = 0;
+
+    // lock memory, can't swap to disk
     if( mlockall( MCL_CURRENT | MCL_FUTURE ) ) {
-        syslog( LOG_ERR, "Couldn't lock pages in memory: %s",
-                strerror(errno) );
+        SNS_LOG( LOG_ERR, "Couldn't lock pages in memory: %s\n",
+                 strerror(errno) );
+    } else {
+        applied |= SNS_RT_MLOCK;
     }
 
+    applied |= rt_prefault_heap( opts->prefault_heap );
+    applied |= sns_init_rt_thread( opts );
+
+    sns_rt_log( LOG_INFO, "process", applied );
+    return applied;
+}
+
+void sns_rt_log( int priority, const char *name, int applied )
+{
+    SNS_LOG( priority, "%s real-time:%s%s%s%s%s%s%s\n", name,
+             applied ? "" : " none",
+             (applied & SNS_RT_SCHED) ? " sched" : "",
+             (applied & SNS_RT_AFFINITY) ? " affinity" : "",
+             (applied & SNS_RT_MLOCK) ? " mlock" : "",
+             (applied & SNS_RT_PREFAULT_STACK) ? " stack" : "",
+             (applied & SNS_RT_PREFAULT_HEAP) ? " heap" : "",
+             (applied & SNS_RT_PREFAULT_REGION) ? " region" : "" );
 }
 
 
 static ach_channel_t **cancel_chans = NULL;
+static volatile sig_atomic_t cancel_fd = -1;
 
 static void sighandler_cancel ( int sig ) {
     (void)sig;
@@ -237,6 +430,17 @@ static void sighandler_cancel ( int sig ) {
             }
         }
     }
+    /* wake a loop waiting on descriptors */
+    int fd = cancel_fd;
+    if( fd >= 0 ) {
+        uint64_t one = 1;
+        ssize_t w = write( fd, &one, sizeof(one) );
+        (void)w;
+    }
+}
+
+void sns_sigcancel_notify( int fd ) {
+    cancel_fd = fd;
 }
 
 void sns_sigcancel( ach_channel_t **chan, const int *sig ) {
@@ -349,13 +553,27 @@ void sns_start( ) {
     Call this function before your daemon exists.
  */
 void sns_end( ) {
-
+    sns_log_async_stop();
+    sns_log_summarize();
 }
 
 
 
 void sns_event( int level, int code, const char fmt[], ... ) {
     (void) code;
+    /* maybe queue for the flusher; critical messages usually precede
+     * sns_die(), so publish those now */
+    if( level > LOG_CRIT ) {
+        va_list ap;
+        va_start( ap, fmt );
+        int queued = sns_log_async_vput( level, fmt, ap );
+        va_end( ap );
+        if( queued ) return;
+    } else {
+        /* publish queued messages first, they usually explain this one */
+        sns_log_async_flush();
+    }
+
     /* maybe stderr */
     FILE *err = sns_cx.is_initialized ? sns_cx.stderr : stderr ;
     if( err ) {
@@ -382,6 +600,15 @@ void sns_event( int level, int code, const char fmt[], ... ) {
 
     /* else not stderr */
 
+    /* maybe leave formatting to the reader */
+    {
+        va_list ap;
+        va_start( ap, fmt );
+        int sent = sns_log_packed_vput( level, fmt, ap );
+        va_end( ap );
+        if( sent ) return;
+    }
+
     int size;
     /* get size */
     {
@@ -395,9 +622,10 @@ void sns_event( int level, int code, const char fmt[], ... ) {
     uint32_t n_str = (uint32_t)size + 1 + 1; /* size excludes null and maybe add trailing newline */
     size_t n_msg = sns_msg_log_size_n(n_str);
     sns_msg_log_t *msg  = (sns_msg_log_t*)alloca(n_msg);
+    memset( &msg->header, 0, sizeof(msg->header) );
+    sns_msg_header_fill( &msg->header );
     msg->header.n = n_str;
     msg->priority = level;
-    sns_msg_header_fill( &msg->header );
     {
         va_list ap;
         va_start( ap, fmt );
@@ -410,7 +638,7 @@ void sns_event( int level, int code, const char fmt[], ... ) {
     }
 
     /* send message */
-    enum ach_status r = ach_put( &sns_cx.chan_log, msg, n_msg );
+    enum ach_status r = sns_msg_put( &sns_cx.chan_log, &msg->header, n_msg );
     if( ACH_OK != r ) {
         syslog(LOG_ALERT, "Could not put log message: %s\n", ach_result_to_string(r));
         syslog( level, "%s", msg->text );
@@ -428,6 +656,9 @@ void sns_die( ) {
         kill(getppid(), SIGUSR2);
     }
 
+    /* publish the queued messages explaining why */
+    sns_log_async_flush();
+
     /* quit */
     abort();
     exit(EXIT_FAILURE);
@@ -35,26 +35,363 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
+#include <inttypes.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
 #include "sns.h"
 #include <ach/experimental.h>
 #include "sns/event.h"
 
 
+/* Per-handler state for the event loop */
+struct evhandle_cx {
+    struct sns_evhandler *handler;
+    struct sns_msg_recv recv;
+    struct evhandle_queue *queue;   ///< pooled handlers only
+    struct evhandle_pool *pool;     ///< pooled handlers only
+    const struct sns_init_rt_opts *rt; ///< for threads serving this channel
+};
+
+/*---- Statistics ----*/
+
+/* Configure with --disable-evstats to compile out handler statistics */
+#ifdef SNS_NO_EVSTATS
+#define EVSTATS( cx ) ((struct sns_evstats*)NULL)
+#else
+#define EVSTATS( cx ) ((cx)->stats)
+#endif
+
+/* Counters have a single writer, so increment without a locked
+ * instruction; relaxed atomics keep concurrent readers well defined */
+#define EVSTATS_ADD( field, value )                                     \
+    __atomic_store_n( &(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) + (value), \
+                      __ATOMIC_RELAXED )
+
+static inline void
+evstats_frame( struct sns_evhandler *cx, size_t frame_size )
+{
+    struct sns_evstats *st = EVSTATS(cx);
+    if( st ) {
+        EVSTATS_ADD( st->frames, 1 );
+        EVSTATS_ADD( st->bytes, frame_size );
+    }
+}
+
+static inline void
+evstats_missed( struct sns_evhandler *cx, enum ach_status r )
+{
+    struct sns_evstats *st = EVSTATS(cx);
+    if( st && ACH_MISSED_FRAME == r ) EVSTATS_ADD( st->missed, 1 );
+}
+
+/* Latency of a message from its header time to now, false if unknown */
+static int
+evhandle_latency( const void *buf, size_t frame_size, int64_t *latency )
+{
+    if( frame_size < sizeof(struct sns_msg_header) ) return 0;
+    const struct sns_msg_header *msg = (const struct sns_msg_header*)buf;
+    if( 0 == msg->sec && 0 == msg->nsec ) return 0;
+
+    struct timespec now;
+    if( sns_time_get(&now) ) return 0;
+    *latency = ((int64_t)now.tv_sec - msg->sec) * 1000000000 +
+        ((int64_t)now.tv_nsec - (int64_t)msg->nsec);
+    return 1;
+}
+
+static inline void
+evstats_message( struct sns_evhandler *cx, const void *buf, size_t frame_size )
+{
+    struct sns_evstats *st = EVSTATS(cx);
+    int64_t latency;
+    if( st ) {
+        EVSTATS_ADD( st->messages, 1 );
+        if( evhandle_latency(buf, frame_size, &latency) ) {
+            sns_hist_add( st->latency_hist, &st->latency_max_ns, latency );
+        }
+    }
+}
+
+static inline void
+evstats_runtime( struct sns_evhandler *cx, const struct timespec *start )
+{
+    struct sns_evstats *st = EVSTATS(cx);
+    if( st ) {
+        struct timespec end = sns_now();
+        sns_hist_add( st->runtime_hist, &st->runtime_max_ns,
+                      ((int64_t)end.tv_sec - (int64_t)start->tv_sec) * 1000000000 +
+                      (end.tv_nsec - start->tv_nsec) );
+    }
+}
+
+static inline void
+evstats_start( struct sns_evhandler *cx, struct timespec *start )
+{
+    if( EVSTATS(cx) ) *start = sns_now();
+}
+
+void sns_evstats_log( const struct sns_evstats *stats, int priority, const char *name )
+{
+    /* one site logs every report; keep them out of the rate limit */
+    if( !SNS_LOG_PRIORITY(priority) ) return;
+    sns_event( priority, 0,
+               "%s: %"PRIu64" frames, %"PRIu64" missed, %"PRIu64" bytes, %"PRIu64" messages, "
+               "runtime p50/p99/max <%"PRId64"/<%"PRId64"/%"PRId64" ns, "
+               "latency p50/p99/max <%"PRId64"/<%"PRId64"/%"PRId64" ns\n",
+               name, stats->frames, stats->missed, stats->bytes, stats->messages,
+               sns_hist_quantile(stats->runtime_hist, 0.5),
+               sns_hist_quantile(stats->runtime_hist, 0.99),
+               stats->runtime_max_ns,
+               sns_hist_quantile(stats->latency_hist, 0.5),
+               sns_hist_quantile(stats->latency_hist, 0.99),
+               stats->latency_max_ns );
+}
+
+enum ach_status
+sns_evstats_put( ach_channel_t *chan, const struct sns_evhandler *handlers, size_t n )
+{
+    struct sns_msg_evstats *msg = sns_msg_evstats_local_alloc( (uint32_t)n );
+    for( size_t i = 0; i < n; i ++ ) {
+        const struct sns_evstats *st = handlers[i].stats;
+        if( st ) {
+            /* copy field by field for the relaxed loads */
+            struct sns_evstats *d = msg->stats + i;
+            d->frames = __atomic_load_n( &st->frames, __ATOMIC_RELAXED );
+            d->missed = __atomic_load_n( &st->missed, __ATOMIC_RELAXED );
+            d->bytes = __atomic_load_n( &st->bytes, __ATOMIC_RELAXED );
+            d->messages = __atomic_load_n( &st->messages, __ATOMIC_RELAXED );
+            d->runtime_max_ns = __atomic_load_n( &st->runtime_max_ns, __ATOMIC_RELAXED );
+            d->latency_max_ns = __atomic_load_n( &st->latency_max_ns, __ATOMIC_RELAXED );
+            for( size_t k = 0; k < SNS_HIST_BINS; k ++ ) {
+                d->runtime_hist[k] = __atomic_load_n( st->runtime_hist + k, __ATOMIC_RELAXED );
+                d->latency_hist[k] = __atomic_load_n( st->latency_hist + k, __ATOMIC_RELAXED );
+            }
+        }
+    }
+    enum ach_status r = sns_msg_evstats_put( chan, msg );
+    aa_mem_region_local_pop( msg );
+    return r;
+}
+
+
+/*---- Dispatch ----*/
+
+static void
+evhandle_track( struct sns_evhandler *cx, const void *buf, size_t frame_size )
+{
+    if( cx->tracker && frame_size >= sizeof(struct sns_msg_header) ) {
+        sns_msg_tracker_update( cx->tracker, (const struct sns_msg_header*)buf, NULL );
+    }
+}
+
+/* Attribute message latency to spinning or blocking */
+static void
+evhandle_spin_latency( struct sns_evspin *spin, const void *buf, size_t frame_size )
+{
+    int64_t latency;
+    if( !evhandle_latency(buf, frame_size, &latency) ) return;
+    if( spin->spinning ) {
+        spin->hit_msgs++;
+        spin->hit_latency_ns += latency;
+    } else {
+        spin->miss_msgs++;
+        spin->miss_latency_ns += latency;
+    }
+}
+
+/*---- Filters ----*/
+
+const char *sns_evfilter_drop_string( enum sns_evfilter_drop reason )
+{
+    switch( reason ) {
+    case SNS_EVFILTER_SIZE:     return "wrong size";
+    case SNS_EVFILTER_EXPIRED:  return "expired";
+    case SNS_EVFILTER_OLD:      return "old";
+    case SNS_EVFILTER_INTERVAL: return "too soon";
+    case SNS_EVFILTER_DROP_MAX: break;
+    }
+    return "unknown";
+}
+
+void sns_evfilter_init( struct sns_evfilter *filter )
+{
+    memset( filter, 0, sizeof(*filter) );
+}
+
+static int
+evfilter_drop( struct sns_evfilter *filter, enum sns_evfilter_drop reason )
+{
+    filter->dropped[reason]++;
+    return 0;
+}
+
+int sns_evfilter_pass( struct sns_evfilter *filter, const void *buf, size_t frame_size )
+{
+    /* size */
+    const struct sns_msg_type *type = filter->type;
+    size_t header_offset = type ? type->header_offset : 0;
+    if( frame_size < header_offset + sizeof(struct sns_msg_header) ) {
+        return evfilter_drop( filter, SNS_EVFILTER_SIZE );
+    }
+    const struct sns_msg_header *msg =
+        (const struct sns_msg_header*)((const uint8_t*)buf + header_offset);
+    if( type ) {
+        /* sizes of plugin types may be unknown */
+        if( type->size_0 && frame_size < type->size_0 + (size_t)msg->n * type->elt_size ) {
+            return evfilter_drop( filter, SNS_EVFILTER_SIZE );
+        }
+    } else if( filter->size && frame_size != filter->size ) {
+        return evfilter_drop( filter, SNS_EVFILTER_SIZE );
+    }
+
+    /* expiration */
+    if( filter->drop_expired && sns_msg_is_expired(msg, NULL) ) {
+        return evfilter_drop( filter, SNS_EVFILTER_EXPIRED );
+    }
+
+    /* ordering, by sender */
+    if( filter->drop_old && msg->seq &&
+        msg->from_pid == filter->last_pid && msg->seq <= filter->last_seq )
+    {
+        return evfilter_drop( filter, SNS_EVFILTER_OLD );
+    }
+
+    /* rate */
+    struct timespec now = {0, 0};
+    if( filter->min_interval_ns && 0 == sns_time_get(&now) && filter->passed ) {
+        int64_t since = ((int64_t)now.tv_sec - (int64_t)filter->last_delivery.tv_sec) * 1000000000
+            + (now.tv_nsec - filter->last_delivery.tv_nsec);
+        if( since < filter->min_interval_ns ) {
+            return evfilter_drop( filter, SNS_EVFILTER_INTERVAL );
+        }
+    }
+
+    /* delivered */
+    if( msg->seq ) {
+        filter->last_pid = msg->from_pid;
+        filter->last_seq = msg->seq;
+    }
+    filter->last_delivery = now;
+    filter->passed++;
+    return 1;
+}
+
+void sns_evfilter_log( const struct sns_evfilter *filter, int priority, const char *name )
+{
+    SNS_LOG( priority,
+             "%s: %"PRIu64" passed, %"PRIu64" wrong size, %"PRIu64" expired, "
+             "%"PRIu64" old, %"PRIu64" too soon\n",
+             name, filter->passed,
+             filter->dropped[SNS_EVFILTER_SIZE],
+             filter->dropped[SNS_EVFILTER_EXPIRED],
+             filter->dropped[SNS_EVFILTER_OLD],
+             filter->dropped[SNS_EVFILTER_INTERVAL] );
+}
+
+/* Filter, validate, and track one message, returning false to drop it */
+static int
+evhandle_accept( struct sns_evhandler *cx, const void *buf, size_t frame_size )
+{
+    if( cx->filter && !sns_evfilter_pass(cx->filter, buf, frame_size) ) {
+        return 0;
+    }
+    if( cx->validator &&
+        SNS_MSG_VALID != sns_msg_validate(cx->validator, buf, frame_size) )
+    {
+        return 0;
+    }
+    evhandle_track( cx, buf, frame_size );
+    if( cx->spin ) evhandle_spin_latency( cx->spin, buf, frame_size );
+    evstats_message( cx, buf, frame_size );
+    return 1;
+}
+
+/* Call the handler on one message, unless it fails validation */
+static enum ach_status
+evhandle_call( struct sns_evhandler *cx, void *buf, size_t frame_size )
+{
+    if( !evhandle_accept(cx, buf, frame_size) ) return ACH_OK;
+    struct timespec start = {0, 0};
+    evstats_start( cx, &start );
+    enum ach_status r = cx->handler( cx->context, buf, frame_size );
+    evstats_runtime( cx, &start );
+    return r;
+}
+
+/* Drop a frame flagged as a batch that does not parse as one */
+static enum ach_status
+evhandle_bad_batch( void )
+{
+    SNS_LOG( LOG_WARNING, "Dropping malformed batch frame\n" );
+    return ACH_OK;
+}
+
+/* Call the handler on a frame, or on each message of a batch */
 static enum ach_status
-sns_evhandle_impl( struct sns_evhandler *cx, ach_channel_t *channel, const struct timespec *timeout, int ach_options )
+evhandle_dispatch( struct sns_evhandler *cx, void *buf, size_t frame_size )
 {
+    evstats_frame( cx, frame_size );
+    if( sns_msg_is_batch(buf, frame_size) ) {
+        if( !sns_msg_batch_check(buf, frame_size) ) return evhandle_bad_batch();
+        const struct sns_msg_batch *batch = (const struct sns_msg_batch*)buf;
+        const struct sns_msg_header *msg;
+        size_t offset = 0, size;
+        while( NULL != (msg = sns_msg_batch_next(batch, &offset, &size)) ) {
+            enum ach_status r = evhandle_call( cx, (void*)msg, size );
+            if( ACH_OK != r ) return r;
+        }
+        return ACH_OK;
+    }
+
+    return evhandle_call( cx, buf, frame_size );
+}
+
+static enum ach_status
+sns_evhandle_view( void *_cx, const struct sns_msg_view *view )
+{
+    struct sns_evhandler *cx = (struct sns_evhandler *) _cx;
+    sns_time_cache_update();
+    enum ach_status r = evhandle_dispatch( cx, (void*)view->buf, view->frame_size );
+    sns_time_cache_clear();
+    return r;
+}
+
+/* Read and handle one frame */
+static enum ach_status
+evhandle_one( struct evhandle_cx *ecx, const struct timespec *timeout, int ach_options )
+{
+    struct sns_evhandler *cx = ecx->handler;
+
+    /* refreshed by the view callback or after the get returns */
+    sns_time_cache_clear();
+
+    if( cx->in_place ) {
+        /* handler result is returned for any frame that was read */
+        size_t frame_size;
+        enum ach_status r = sns_msg_view_get( cx->channel, sns_evhandle_view, cx,
+                                              &frame_size, timeout, ach_options );
+        evstats_missed( cx, r );
+        return (ACH_MISSED_FRAME == r) ? ACH_OK : r;
+    }
+
     /* get message */
     void *buf = NULL;
     size_t frame_size;
-    enum ach_status r = sns_msg_local_get( channel, &buf,
-                                           &frame_size,
-                                           timeout, ach_options );
+    enum ach_status r = sns_msg_recv_get( &ecx->recv, &buf,
+                                          &frame_size,
+                                          timeout, ach_options );
+    evstats_missed( cx, r );
 
     /* maybe do something */
     if( ach_status_match(r, ACH_MASK_OK | ACH_MASK_MISSED_FRAME) ) {
         assert(buf);
-        r = cx->handler( cx->context, buf, frame_size );
-        aa_mem_region_local_pop(buf);
+        sns_time_cache_update();
+        r = evhandle_dispatch( cx, buf, frame_size );
+        sns_time_cache_clear();
     } else {
         assert( NULL == buf );
     }
@@ -62,14 +399,1118 @@ sns_evhandle_impl( struct sns_evhandler *cx, ach_channel_t *channel, const struc
     return r;
 }
 
+static size_t
+evhandle_batch_max( const struct sns_evhandler *cx )
+{
+    return cx->batch_max ? cx->batch_max : SNS_EVHANDLER_BATCH_DEFAULT;
+}
+
+/* Options to poll for further frames after the first of a wakeup */
+static int
+evhandle_more_options( int ach_options )
+{
+    return ach_options & ~(ACH_O_WAIT | ACH_O_LAST);
+}
+
+/* Continue draining after the first frame of a wakeup, with result r */
+static enum ach_status
+evhandle_drain_rest( struct evhandle_cx *ecx, enum ach_status r, int ach_options )
+{
+    size_t max = evhandle_batch_max( ecx->handler );
+    for( size_t i = 1; ACH_OK == r && i < max; i++ ) {
+        r = evhandle_one( ecx, NULL, evhandle_more_options(ach_options) );
+        /* caught up */
+        if( ACH_STALE_FRAMES == r ) return ACH_OK;
+    }
+    return r;
+}
+
+/* Read and handle pending frames, up to batch_max */
+static enum ach_status
+evhandle_drain( struct evhandle_cx *ecx, const struct timespec *timeout, int ach_options )
+{
+    enum ach_status r = evhandle_one( ecx, timeout, ach_options );
+    return evhandle_drain_rest( ecx, r, ach_options );
+}
+
+/* Count frames skipped by a read with ACH_O_LAST, given the sequence
+ * number before it.
+ *
+ * ach only reports that frames were missed, not how many, so this
+ * reads ach_channel_t::seq_num, the sequence number of the last frame
+ * read through the handle.  The field is visible in ach.h but is not
+ * part of ach's documented interface; if it changes, only the skipped
+ * count is affected. */
+static void
+evhandle_skipped( struct sns_evhandler *cx, uint64_t seq )
+{
+    uint64_t got = cx->channel->seq_num;
+    /* the first read after opening the channel skips nothing */
+    if( seq && got > seq + 1 ) cx->skipped += got - seq - 1;
+}
+
+/* Read and handle only the newest frame */
+static enum ach_status
+evhandle_latest( struct evhandle_cx *ecx, const struct timespec *timeout, int ach_options )
+{
+    struct sns_evhandler *cx = ecx->handler;
+    uint64_t seq = cx->channel->seq_num;
+    enum ach_status r = evhandle_one( ecx, timeout, ach_options | ACH_O_LAST );
+    evhandle_skipped( cx, seq );
+    return r;
+}
+
+static enum ach_status
+evhandle_coalesce_call( struct sns_evhandler *cx, struct sns_evframe *frames, size_t n )
+{
+    struct timespec start = {0, 0};
+    evstats_start( cx, &start );
+    enum ach_status r = cx->coalesce_handler( cx->context, frames, n );
+    evstats_runtime( cx, &start );
+    return r;
+}
+
+/* Add the messages of a frame to a coalesced set, passing the set to
+ * the handler when it fills */
+static enum ach_status
+evhandle_coalesce_add( struct sns_evhandler *cx, struct sns_evframe *frames,
+                       size_t *n, size_t max, void *buf, size_t frame_size )
+{
+    evstats_frame( cx, frame_size );
+    const struct sns_msg_batch *batch = NULL;
+    size_t offset = 0;
+    if( sns_msg_is_batch(buf, frame_size) ) {
+        if( !sns_msg_batch_check(buf, frame_size) ) return evhandle_bad_batch();
+        batch = (const struct sns_msg_batch*)buf;
+        buf = (void*)sns_msg_batch_next( batch, &offset, &frame_size );
+    }
+
+    while( buf ) {
+        if( evhandle_accept(cx, buf, frame_size) ) {
+            if( max == *n ) {
+                enum ach_status r = evhandle_coalesce_call( cx, frames, *n );
+                *n = 0;
+                if( ACH_OK != r ) return r;
+            }
+            frames[*n].msg = buf;
+            frames[*n].msg_size = frame_size;
+            (*n)++;
+        }
+        buf = batch ? (void*)sns_msg_batch_next( batch, &offset, &frame_size ) : NULL;
+    }
+    return ACH_OK;
+}
+
+/* Given the first frame of a wakeup, read further pending frames, up
+ * to batch_max, and handle them together */
+static enum ach_status
+evhandle_coalesce_rest( struct evhandle_cx *ecx, void *buf, size_t frame_size,
+                        int ach_options )
+{
+    struct sns_evhandler *cx = ecx->handler;
+    size_t max = evhandle_batch_max( cx );
+    /* released with the frames by the caller */
+    struct sns_evframe *frames = (struct sns_evframe*)
+        aa_mem_region_local_alloc( max * sizeof(frames[0]) );
+    size_t n = 0;
+
+    sns_time_cache_update();
+    enum ach_status r = evhandle_coalesce_add( cx, frames, &n, max, buf, frame_size );
+    for( size_t i = 1; ACH_OK == r && i < max; i++ ) {
+        enum ach_status rg = sns_msg_local_get( cx->channel, &buf, &frame_size, NULL,
+                                                evhandle_more_options(ach_options) );
+        evstats_missed( cx, rg );
+        if( !ach_status_match(rg, ACH_MASK_OK | ACH_MASK_MISSED_FRAME) ) break;
+        sns_time_cache_update();
+        r = evhandle_coalesce_add( cx, frames, &n, max, buf, frame_size );
+    }
+
+    if( ACH_OK == r && n ) {
+        r = evhandle_coalesce_call( cx, frames, n );
+    }
+    sns_time_cache_clear();
+    return r;
+}
+
+/* Read pending frames, up to batch_max, and handle them together */
+static enum ach_status
+evhandle_coalesce( struct evhandle_cx *ecx, const struct timespec *timeout, int ach_options )
+{
+    void *buf = NULL;
+    size_t frame_size;
+    sns_time_cache_clear();
+    enum ach_status r = sns_msg_local_get( ecx->handler->channel, &buf, &frame_size,
+                                           timeout, ach_options );
+    evstats_missed( ecx->handler, r );
+    if( !ach_status_match(r, ACH_MASK_OK | ACH_MASK_MISSED_FRAME) ) return r;
+    return evhandle_coalesce_rest( ecx, buf, frame_size, ach_options );
+}
+
+static enum ach_status
+evhandle_mode( struct evhandle_cx *ecx, const struct timespec *timeout, int ach_options )
+{
+    enum ach_status r = ACH_BUG;
+    switch( ecx->handler->mode ) {
+    case SNS_EVHANDLER_EACH:
+        r = evhandle_one( ecx, timeout, ach_options );
+        break;
+    case SNS_EVHANDLER_DRAIN:
+        r = evhandle_drain( ecx, timeout, ach_options );
+        break;
+    case SNS_EVHANDLER_LATEST:
+        r = evhandle_latest( ecx, timeout, ach_options );
+        break;
+    case SNS_EVHANDLER_COALESCE:
+        r = evhandle_coalesce( ecx, timeout, ach_options );
+        break;
+    }
+    return r;
+}
+
+/*---- Busy polling ----*/
+
+/* Pause hints between polls */
+#define EVHANDLE_SPIN_PAUSES 16
+
+/* True if the channel may hold a frame newer than the last one read
+ * through this handle.
+ *
+ * Reads the sequence number of the newest frame from the channel
+ * header without taking the channel lock, so spinning does not
+ * contend with the writer's ach_put().  ach_header_t::last_seq and
+ * ach_channel_t::seq_num are visible in ach.h but are not part of
+ * ach's documented interface.  Kernel channels have no header in
+ * process memory, so for them every poll is an ach_get(). */
+static inline int
+evhandle_spin_ready( const ach_channel_t *channel )
+{
+    return NULL == channel->shm ||
+        __atomic_load_n( &channel->shm->last_seq, __ATOMIC_ACQUIRE ) != channel->seq_num;
+}
+
+static inline void
+evhandle_cpu_relax( void )
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__ ( "yield" ::: "memory" );
+#else
+    __asm__ __volatile__ ( "" ::: "memory" );
+#endif
+}
+
+void sns_evspin_init( struct sns_evspin *spin, const struct timespec *budget )
+{
+    memset( spin, 0, sizeof(*spin) );
+    spin->budget_ns = (int64_t)budget->tv_sec * 1000000000 + budget->tv_nsec;
+    spin->current_ns = spin->budget_ns;
+}
+
+void sns_evspin_log( const struct sns_evspin *spin, int priority, const char *name )
+{
+    SNS_LOG( priority,
+             "%s: %"PRIu64" spin hits, %"PRIu64" misses, %"PRId64" ns spinning, "
+             "mean latency %"PRId64" ns spinning, %"PRId64" ns blocking\n",
+             name, spin->hits, spin->misses, spin->spin_ns,
+             spin->hit_msgs ? spin->hit_latency_ns / (int64_t)spin->hit_msgs : 0,
+             spin->miss_msgs ? spin->miss_latency_ns / (int64_t)spin->miss_msgs : 0 );
+}
+
+/* Poll until a frame arrives or the budget runs out, then block */
+static enum ach_status
+evhandle_spin( struct evhandle_cx *ecx, const struct timespec *timeout, int ach_options )
+{
+    struct sns_evspin *spin = ecx->handler->spin;
+    ach_channel_t *channel = ecx->handler->channel;
+    int poll_options = ach_options & ~ACH_O_WAIT;
+
+    struct timespec start = sns_now();
+    struct timespec end = sns_time_add_ns( start, spin->current_ns );
+    if( timeout && SNS_TIME_GT(end, (*timeout)) ) end = *timeout;
+
+    struct timespec now = start;
+    enum ach_status r = ACH_STALE_FRAMES;
+    spin->spinning = 1;
+    for(;;) {
+        /* only take the channel lock once there is something to get */
+        if( evhandle_spin_ready(channel) ) {
+            r = evhandle_mode( ecx, NULL, poll_options );
+            if( ACH_STALE_FRAMES != r ) break;
+        }
+        for( size_t i = 0; i < EVHANDLE_SPIN_PAUSES; i++ ) evhandle_cpu_relax();
+        now = sns_now();
+        if( !SNS_TIME_GT(end, now) || sns_cx.shutdown ) break;
+    }
+    spin->spinning = 0;
+    /* time before the last poll, excluding any handler */
+    spin->spin_ns += (int64_t)(now.tv_sec - start.tv_sec) * 1000000000 +
+        (now.tv_nsec - start.tv_nsec);
+
+    if( ACH_STALE_FRAMES != r ) {
+        spin->hits++;
+        spin->current_ns *= 2;
+        if( spin->current_ns > spin->budget_ns ) spin->current_ns = spin->budget_ns;
+        return r;
+    }
+
+    spin->misses++;
+    if( spin->current_ns > spin->budget_ns / 16 ) spin->current_ns /= 2;
+    if( spin->current_ns < 1 ) spin->current_ns = 1;
+    return evhandle_mode( ecx, timeout, ach_options );
+}
+
+static enum ach_status
+sns_evhandle_impl( struct evhandle_cx *ecx, const struct timespec *timeout, int ach_options )
+{
+    /* release whatever the handler allocates from the local region */
+    void *mark = aa_mem_region_local_alloc(1);
+    enum ach_status r;
+    if( ecx->handler->spin && (ach_options & ACH_O_WAIT) ) {
+        r = evhandle_spin( ecx, timeout, ach_options );
+    } else {
+        r = evhandle_mode( ecx, timeout, ach_options );
+    }
+    aa_mem_region_local_pop(mark);
+    return r;
+}
+
+
+/* Periodic handler and timers for the ach event loop */
+struct evhandle_periodic_cx {
+    const struct sns_evhandle_opts *opts;
+    struct sns_periodic *sched;     ///< NULL for relative timeouts
+    struct sns_timer_wheel *timers; ///< NULL without timers
+    struct sns_periodic *stats;     ///< NULL without statistics messages
+    const struct sns_evhandler *handlers;
+    size_t n;
+};
+
+/* True if anything runs on absolute deadlines */
+static int
+evhandle_scheduled( const struct evhandle_periodic_cx *cx )
+{
+    return cx->sched || cx->timers || cx->stats;
+}
+
+static enum ach_status
+evhandle_periodic_run( const struct sns_evhandle_opts *opts )
+{
+    sns_time_cache_update();
+    enum ach_status r = opts->periodic_handler( opts->periodic_context );
+    sns_time_cache_clear();
+    return r;
+}
+
+/* Run a scheduled cycle if it is due */
+static enum ach_status
+evhandle_periodic_sched( const struct sns_evhandle_opts *opts, struct sns_periodic *sched )
+{
+    struct timespec now = sns_now();
+    if( !sns_periodic_due(sched, &now) ) return ACH_OK;
+
+    sns_periodic_begin( sched, &now );
+    enum ach_status r = evhandle_periodic_run( opts );
+    now = sns_now();
+    sns_periodic_end( sched, &now );
+    return r;
+}
+
+/* Run the scheduled periodic handler and timers that are due */
+static enum ach_status
+evhandle_timed( struct evhandle_periodic_cx *cx )
+{
+    enum ach_status r = ACH_OK;
+    if( cx->sched ) {
+        r = evhandle_periodic_sched( cx->opts, cx->sched );
+    }
+    if( ACH_OK == r && cx->timers ) {
+        struct timespec now = sns_now();
+        r = sns_timer_wheel_expire( cx->timers, &now );
+    }
+    if( ACH_OK == r && cx->stats ) {
+        struct timespec now = sns_now();
+        if( sns_periodic_due(cx->stats, &now) ) {
+            sns_periodic_begin( cx->stats, &now );
+            r = sns_evstats_put( cx->opts->stats_channel, cx->handlers, cx->n );
+            now = sns_now();
+            sns_periodic_end( cx->stats, &now );
+        }
+    }
+    return r;
+}
+
+/* Absolute time of the next scheduled release, or NULL if none */
+static const struct timespec *
+evhandle_release( const struct evhandle_periodic_cx *cx, struct timespec *when )
+{
+    struct timespec t;
+    int have = 0;
+    if( cx->sched ) {
+        *when = cx->sched->release;
+        have = 1;
+    }
+    if( cx->timers && sns_timer_wheel_next(cx->timers, &t) ) {
+        if( !have || SNS_TIME_GT((*when), t) ) *when = t;
+        have = 1;
+    }
+    if( cx->stats ) {
+        t = cx->stats->release;
+        if( !have || SNS_TIME_GT((*when), t) ) *when = t;
+        have = 1;
+    }
+    return have ? when : NULL;
+}
+
+/* Periodic handler for the ach event loop, which runs it on relative
+ * timeouts */
+static enum ach_status
+sns_evhandle_periodic( void *_cx )
+{
+    struct evhandle_periodic_cx *cx = (struct evhandle_periodic_cx *) _cx;
+    return evhandle_periodic_run( cx->opts );
+}
+
+/* Set when the ach event loop handled input since its last periodic
+ * call */
+static __thread int evhandle_input = 0;
 
 static enum ach_status
 sns_evhandle_fun( void *_cx, ach_channel_t *channel )
 {
-    struct sns_evhandler *cx = (struct sns_evhandler *) _cx;
-    return sns_evhandle_impl(cx, channel, NULL, cx->ach_options);
+    (void)channel;
+    struct evhandle_cx *ecx = (struct evhandle_cx *) _cx;
+    evhandle_input = 1;
+    return sns_evhandle_impl(ecx, NULL, ecx->handler->ach_options);
+}
+
+/* Result of a handler run off the main thread */
+static void
+evhandle_check( enum ach_status r )
+{
+    SNS_REQUIRE( ach_status_match(r, ACH_MASK_OK | ACH_MASK_STALE_FRAMES),
+                 "Could not handle events: %s, %s\n",
+                 ach_result_to_string(r),
+                 strerror(errno) );
+}
+
+
+/*---- Dedicated threads ----*/
+
+/* Apply real-time settings at the start of a loop thread */
+static void
+evhandle_thread_rt( const struct sns_init_rt_opts *rt, const char *name )
+{
+    if( rt ) sns_rt_log( LOG_DEBUG, name, sns_init_rt_thread(rt) );
+}
+
+static void *
+evhandle_dedicated( void *_cx )
+{
+    struct evhandle_cx *ecx = (struct evhandle_cx *) _cx;
+    evhandle_thread_rt( ecx->rt, "handler thread" );
+    while( !sns_cx.shutdown ) {
+        errno = 0;
+        enum ach_status r = sns_evhandle_impl( ecx, NULL,
+                                               ecx->handler->ach_options | ACH_O_WAIT );
+        if( sns_cx.shutdown || ACH_CANCELED == r ) break;
+        evhandle_check( r );
+    }
+    aa_mem_region_local_destroy();
+    return NULL;
+}
+
+
+/*---- Worker pool ----*/
+
+/* Messages buffered for each pooled channel.  When full, the oldest is
+ * dropped, as ach would for any slow reader. */
+#define EVHANDLE_QUEUE_SIZE 8
+
+struct evhandle_slot {
+    void *buf;
+    size_t size;
+    size_t frame_size;
+};
+
+/* Messages received for a pooled channel, waiting for a worker.  At
+ * most one worker runs a channel at a time, which keeps its messages
+ * in order. */
+struct evhandle_queue {
+    pthread_mutex_t mutex;
+    struct evhandle_slot slot[EVHANDLE_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    /* spare buffers: poller and worker each hold one besides the queue */
+    struct evhandle_slot spare[EVHANDLE_QUEUE_SIZE+2];
+    size_t n_spare;
+    int scheduled;
+    uint64_t dropped;
+};
+
+/* Channels ready to run.  The owner takes the oldest from the top, so
+ * that channels are served in turn; idle workers steal the newest
+ * from the bottom. */
+struct evhandle_deque {
+    pthread_mutex_t mutex;
+    struct evhandle_cx **task;
+    size_t top;
+    size_t bottom;
+};
+
+struct evhandle_pool {
+    pthread_mutex_t mutex;        ///< protects pending, stop, and the wait
+    pthread_cond_t cond;
+    size_t pending;               ///< tasks in all deques
+    int stop;
+    size_t next;                  ///< round-robin target for new tasks
+    size_t n_tasks;               ///< capacity of each deque
+    size_t n_workers;
+    struct evhandle_deque *deque;
+    struct evhandle_worker *worker;
+    pthread_t *thread;
+    const struct sns_init_rt_opts *rt;
+};
+
+struct evhandle_worker {
+    struct evhandle_pool *pool;
+    size_t id;
+};
+
+static void
+pool_push( struct evhandle_pool *pool, size_t k, struct evhandle_cx *ecx )
+{
+    struct evhandle_deque *d = pool->deque + k;
+    pthread_mutex_lock( &d->mutex );
+    d->task[d->bottom++ % pool->n_tasks] = ecx;
+    pthread_mutex_unlock( &d->mutex );
+
+    pthread_mutex_lock( &pool->mutex );
+    pool->pending++;
+    pthread_cond_signal( &pool->cond );
+    pthread_mutex_unlock( &pool->mutex );
+}
+
+static struct evhandle_cx *
+pool_take( struct evhandle_pool *pool, size_t k, int steal )
+{
+    struct evhandle_deque *d = pool->deque + k;
+    struct evhandle_cx *ecx = NULL;
+    pthread_mutex_lock( &d->mutex );
+    if( d->bottom != d->top ) {
+        ecx = steal ?
+            d->task[--d->bottom % pool->n_tasks] :
+            d->task[d->top++ % pool->n_tasks];
+    }
+    pthread_mutex_unlock( &d->mutex );
+
+    if( ecx ) {
+        pthread_mutex_lock( &pool->mutex );
+        pool->pending--;
+        pthread_mutex_unlock( &pool->mutex );
+    }
+    return ecx;
+}
+
+/* Own deque first, then steal */
+static struct evhandle_cx *
+pool_next( struct evhandle_pool *pool, size_t id )
+{
+    struct evhandle_cx *ecx = pool_take( pool, id, 0 );
+    for( size_t i = 1; NULL == ecx && i < pool->n_workers; i ++ ) {
+        ecx = pool_take( pool, (id + i) % pool->n_workers, 1 );
+    }
+    return ecx;
+}
+
+/* Run queued messages of one channel.  Returns true if messages remain
+ * and the channel should be requeued, so that a busy channel cannot
+ * hold a worker indefinitely. */
+static int
+pool_run( struct evhandle_cx *ecx )
+{
+    struct evhandle_queue *q = ecx->queue;
+    for( size_t i = 0; ; i ++ ) {
+        pthread_mutex_lock( &q->mutex );
+        if( 0 == q->count ) {
+            q->scheduled = 0;
+            pthread_mutex_unlock( &q->mutex );
+            return 0;
+        } else if( EVHANDLE_QUEUE_SIZE == i ) {
+            pthread_mutex_unlock( &q->mutex );
+            return 1;
+        }
+        struct evhandle_slot slot = q->slot[q->head];
+        q->head = (q->head + 1) % EVHANDLE_QUEUE_SIZE;
+        q->count--;
+        pthread_mutex_unlock( &q->mutex );
+
+        sns_time_cache_update();
+        void *mark = aa_mem_region_local_alloc(1);
+        errno = 0;
+        enum ach_status r = evhandle_dispatch( ecx->handler, slot.buf, slot.frame_size );
+        aa_mem_region_local_pop(mark);
+        sns_time_cache_clear();
+
+        pthread_mutex_lock( &q->mutex );
+        q->spare[q->n_spare++] = slot;
+        pthread_mutex_unlock( &q->mutex );
+
+        evhandle_check( r );
+    }
+}
+
+static void *
+pool_worker( void *_cx )
+{
+    struct evhandle_worker *w = (struct evhandle_worker *) _cx;
+    struct evhandle_pool *pool = w->pool;
+    evhandle_thread_rt( pool->rt, "pool worker" );
+
+    for(;;) {
+        struct evhandle_cx *ecx = pool_next( pool, w->id );
+        if( ecx ) {
+            if( pool_run( ecx ) ) pool_push( pool, w->id, ecx );
+            continue;
+        }
+        pthread_mutex_lock( &pool->mutex );
+        while( !pool->stop && 0 == pool->pending ) {
+            pthread_cond_wait( &pool->cond, &pool->mutex );
+        }
+        int stop = pool->stop;
+        pthread_mutex_unlock( &pool->mutex );
+        if( stop ) break;
+    }
+
+    aa_mem_region_local_destroy();
+    return NULL;
 }
 
+/* Receive into the queue and schedule the channel */
+static enum ach_status
+pool_enqueue( struct evhandle_cx *ecx, int ach_options )
+{
+    struct evhandle_queue *q = ecx->queue;
+
+    void *buf = NULL;
+    size_t frame_size;
+    enum ach_status r = sns_msg_recv_get( &ecx->recv, &buf, &frame_size,
+                                          NULL, ach_options );
+    evstats_missed( ecx->handler, r );
+    if( !ach_status_match(r, ACH_MASK_OK | ACH_MASK_MISSED_FRAME) ) return r;
+
+    pthread_mutex_lock( &q->mutex );
+    if( EVHANDLE_QUEUE_SIZE == q->count ) {
+        q->spare[q->n_spare++] = q->slot[q->head];
+        q->head = (q->head + 1) % EVHANDLE_QUEUE_SIZE;
+        q->count--;
+        q->dropped++;
+    }
+    struct evhandle_slot *slot = q->slot + (q->head + q->count++) % EVHANDLE_QUEUE_SIZE;
+    slot->buf = ecx->recv.buf;
+    slot->size = ecx->recv.size;
+    slot->frame_size = frame_size;
+    if( q->n_spare ) {
+        struct evhandle_slot *spare = q->spare + --q->n_spare;
+        ecx->recv.buf = spare->buf;
+        ecx->recv.size = spare->size;
+    } else {
+        ecx->recv.buf = NULL;
+        ecx->recv.size = 0;
+    }
+    int schedule = !q->scheduled;
+    q->scheduled = 1;
+    pthread_mutex_unlock( &q->mutex );
+
+    if( schedule ) {
+        struct evhandle_pool *pool = ecx->pool;
+        size_t k = __atomic_fetch_add( &pool->next, 1, __ATOMIC_RELAXED ) % pool->n_workers;
+        pool_push( pool, k, ecx );
+    }
+
+    return ACH_OK;
+}
+
+/* ach handler for pooled channels */
+static enum ach_status
+pool_receive( void *_cx, ach_channel_t *channel )
+{
+    (void)channel;
+    struct evhandle_cx *ecx = (struct evhandle_cx *) _cx;
+    evhandle_input = 1;
+    return pool_enqueue( ecx, ecx->handler->ach_options );
+}
+
+static void
+pool_start( struct evhandle_pool *pool, size_t n_tasks, size_t n_workers,
+            const struct sns_init_rt_opts *rt )
+{
+    pthread_mutex_init( &pool->mutex, NULL );
+    pthread_cond_init( &pool->cond, NULL );
+    pool->pending = 0;
+    pool->stop = 0;
+    pool->next = 0;
+    pool->n_tasks = n_tasks;
+    pool->n_workers = n_workers;
+    pool->rt = rt;
+    pool->deque = AA_NEW0_AR( struct evhandle_deque, n_workers );
+    pool->thread = AA_NEW0_AR( pthread_t, n_workers );
+
+    struct evhandle_worker *w = AA_NEW0_AR( struct evhandle_worker, n_workers );
+    for( size_t i = 0; i < n_workers; i ++ ) {
+        pthread_mutex_init( &pool->deque[i].mutex, NULL );
+        pool->deque[i].task = AA_NEW0_AR( struct evhandle_cx*, n_tasks );
+        w[i].pool = pool;
+        w[i].id = i;
+    }
+    pool->worker = w;
+    for( size_t i = 0; i < n_workers; i ++ ) {
+        int e = pthread_create( pool->thread + i, NULL, pool_worker, w + i );
+        SNS_REQUIRE( 0 == e, "Could not create worker thread: %s\n", strerror(e) );
+    }
+}
+
+static void
+pool_stop( struct evhandle_pool *pool )
+{
+    pthread_mutex_lock( &pool->mutex );
+    pool->stop = 1;
+    pthread_cond_broadcast( &pool->cond );
+    pthread_mutex_unlock( &pool->mutex );
+
+    for( size_t i = 0; i < pool->n_workers; i ++ ) {
+        pthread_join( pool->thread[i], NULL );
+        pthread_mutex_destroy( &pool->deque[i].mutex );
+        free( pool->deque[i].task );
+    }
+    pthread_cond_destroy( &pool->cond );
+    pthread_mutex_destroy( &pool->mutex );
+    free( pool->worker );
+    free( pool->thread );
+    free( pool->deque );
+}
+
+static void
+queue_init( struct evhandle_queue *q )
+{
+    memset( q, 0, sizeof(*q) );
+    pthread_mutex_init( &q->mutex, NULL );
+}
+
+static void
+queue_destroy( struct evhandle_queue *q )
+{
+    for( size_t i = 0; i < q->count; i ++ ) {
+        free( q->slot[(q->head + i) % EVHANDLE_QUEUE_SIZE].buf );
+    }
+    for( size_t i = 0; i < q->n_spare; i ++ ) {
+        free( q->spare[i].buf );
+    }
+    pthread_mutex_destroy( &q->mutex );
+}
+
+
+/*---- Event loop ----*/
+
+static void
+evhandle_periodic_check( enum ach_status r )
+{
+    SNS_REQUIRE( ACH_OK == r, "Could not handle events: %s\n",
+                 ach_result_to_string(r) );
+}
+
+/* Main thread when every handler runs elsewhere */
+static void
+evhandle_idle( struct evhandle_periodic_cx *timed )
+{
+    while( !sns_cx.shutdown ) {
+        struct timespec when;
+        if( NULL == evhandle_release(timed, &when) ) {
+            pause();
+            continue;
+        }
+        if( clock_nanosleep( SNS_CLOCK, TIMER_ABSTIME, &when, NULL ) ) continue;
+        if( sns_cx.shutdown ) break;
+        evhandle_periodic_check( evhandle_timed(timed) );
+    }
+}
+
+/* Single channel: wait in ach_get() directly, which can spin in
+ * userspace, until the next release of the periodic handler */
+static void
+evhandle_single( struct evhandle_cx *ecx, struct evhandle_periodic_cx *timed )
+{
+    const struct sns_evhandle_opts *opts = timed->opts;
+    int ach_options = ecx->handler->ach_options | ACH_O_WAIT;
+    int on_input = opts->periodic_handler && (opts->options & ACH_EV_O_PERIODIC_INPUT);
+
+    while( !sns_cx.shutdown) {
+        errno = 0;
+        struct timespec when;
+        enum ach_status r = sns_evhandle_impl( ecx, evhandle_release(timed, &when),
+                                               ach_options );
+        if(sns_cx.shutdown) break;
+        SNS_REQUIRE( ACH_OK == r || ACH_TIMEOUT == r,
+                     "Could not handle events: %s, %s\n",
+                     ach_result_to_string(r),
+                     strerror(errno) );
+
+        if( ACH_OK == r && on_input ) {
+            evhandle_periodic_check( evhandle_periodic_run(opts) );
+        }
+
+        /* run when released, even under steady input */
+        evhandle_periodic_check( evhandle_timed(timed) );
+    }
+}
+
+/* Periodic call of the ach event loop with a schedule.  Runs what is
+ * due, then leaves ach_evhandle() so that the loop below can wait
+ * again with the time left until the next release. */
+static enum ach_status
+evhandle_ach_timed( void *_cx )
+{
+    struct evhandle_periodic_cx *timed = (struct evhandle_periodic_cx *) _cx;
+    const struct sns_evhandle_opts *opts = timed->opts;
+    if( evhandle_input && opts->periodic_handler &&
+        (opts->options & ACH_EV_O_PERIODIC_INPUT) )
+    {
+        evhandle_periodic_check( evhandle_periodic_run(opts) );
+    }
+    evhandle_input = 0;
+    evhandle_periodic_check( evhandle_timed(timed) );
+    return ACH_TIMEOUT;
+}
+
+/* Multiple channels: ach_evhandle(), which checks every channel on
+ * each wakeup but needs no extra threads */
+static void
+evhandle_ach( struct evhandle_cx *cx, size_t n, size_t n_ach,
+              struct evhandle_periodic_cx *timed )
+{
+    const struct sns_evhandle_opts *opts = timed->opts;
+    struct ach_evhandler ach_handlers[n_ach];
+    for( size_t i = 0, j = 0; i < n; i ++ ) {
+        if( SNS_EVHANDLER_THREAD_DEDICATED == cx[i].handler->thread ) continue;
+        ach_handlers[j].context = cx + i;
+        ach_handlers[j].channel = cx[i].handler->channel;
+        ach_handlers[j].handler = cx[i].queue ? pool_receive : sns_evhandle_fun;
+        j++;
+    }
+
+    int scheduled = evhandle_scheduled( timed );
+    while( !sns_cx.shutdown) {
+        errno = 0;
+        enum ach_status r;
+        if( scheduled ) {
+            /* ach_evhandle() only takes a relative timeout */
+            struct timespec when, timeout = {0, 0};
+            if( evhandle_release(timed, &when) ) {
+                struct timespec now = sns_now();
+                if( SNS_TIME_GT(when, now) ) {
+                    int64_t ns = ((int64_t)when.tv_sec - now.tv_sec) * 1000000000 +
+                        (when.tv_nsec - now.tv_nsec);
+                    timeout = sns_time_add_ns( timeout, ns );
+                }
+            }
+            r = ach_evhandle( ach_handlers, n_ach, &timeout,
+                              evhandle_ach_timed, timed,
+                              ACH_EV_O_PERIODIC_INPUT | ACH_EV_O_PERIODIC_TIMEOUT );
+        } else {
+            r = ach_evhandle( ach_handlers, n_ach,
+                              opts->period,
+                              opts->periodic_handler ?
+                              sns_evhandle_periodic : NULL,
+                              timed,
+                              opts->options );
+        }
+        if(sns_cx.shutdown) break;
+        SNS_REQUIRE( ACH_OK == r || (scheduled && ACH_TIMEOUT == r),
+                     "Could not handle events: %s, %s\n",
+                     ach_result_to_string(r),
+                     strerror(errno) );
+    }
+}
+
+
+/*---- epoll backend ----*/
+
+/* Channels with a pollable descriptor, i.e., kernel channels, are
+ * added to the epoll set directly and read without blocking when
+ * ready.  Channels in process memory have no such descriptor, so each
+ * gets a watcher thread blocking in ach_get().  Watchers of
+ * main-thread channels hand each received frame over through an
+ * eventfd and wait until it is handled; watchers of pooled channels
+ * queue frames for the pool directly.  The main thread then only
+ * wakes for, and only visits, the channels that are ready. */
+
+#define EVHANDLE_EPOLL_EVENTS 64
+
+struct evhandle_watch {
+    struct evhandle_cx *ecx;
+    int direct;                 ///< channel descriptor is in the epoll set
+    int efd;                    ///< signaled when a frame is received, main channels only
+    int stop_fd;                ///< signaled when the watcher exits
+    sem_t ack;                  ///< posted when the frame has been handled
+    enum ach_status status;     ///< result of the receive
+    void *buf;                  ///< the received frame
+    size_t frame_size;          ///< size of the received frame
+    pthread_t thread;
+};
+
+static void
+evhandle_notify( int fd )
+{
+    uint64_t one = 1;
+    ssize_t w;
+    do {
+        w = write( fd, &one, sizeof(one) );
+    } while( w < 0 && EINTR == errno );
+    SNS_REQUIRE( sizeof(one) == w, "Could not signal eventfd: %s\n", strerror(errno) );
+}
+
+static void
+evhandle_watcher_loop( struct evhandle_watch *w )
+{
+    struct evhandle_cx *ecx = w->ecx;
+    struct sns_evhandler *cx = ecx->handler;
+    int ach_options = cx->ach_options | ACH_O_WAIT;
+
+    if( ecx->queue ) {
+        while( !sns_cx.shutdown ) {
+            errno = 0;
+            enum ach_status r = pool_enqueue( ecx, ach_options );
+            if( sns_cx.shutdown || ACH_CANCELED == r ) break;
+            evhandle_check( r );
+        }
+        return;
+    }
+
+    if( SNS_EVHANDLER_LATEST == cx->mode ) ach_options |= ACH_O_LAST;
+    while( !sns_cx.shutdown ) {
+        uint64_t seq = cx->channel->seq_num;
+        w->buf = NULL;
+        w->status = sns_msg_recv_get( &ecx->recv, &w->buf, &w->frame_size,
+                                      NULL, ach_options );
+        evstats_missed( cx, w->status );
+        if( SNS_EVHANDLER_LATEST == cx->mode ) evhandle_skipped( cx, seq );
+        if( ACH_CANCELED == w->status ) break;
+        evhandle_notify( w->efd );
+        while( sem_wait( &w->ack ) && EINTR == errno );
+    }
+}
+
+static void *
+evhandle_watcher( void *_w )
+{
+    struct evhandle_watch *w = (struct evhandle_watch *) _w;
+    evhandle_thread_rt( w->ecx->rt, "watcher thread" );
+    evhandle_watcher_loop( w );
+    /* the main thread may be waiting for this channel only */
+    evhandle_notify( w->stop_fd );
+    return NULL;
+}
+
+/* Handle a frame received by a watcher, then any others the mode
+ * consumes on the same wakeup */
+static enum ach_status
+evhandle_received( struct evhandle_watch *w )
+{
+    struct evhandle_cx *ecx = w->ecx;
+    struct sns_evhandler *cx = ecx->handler;
+    enum ach_status r;
+
+    void *mark = aa_mem_region_local_alloc(1);
+    if( SNS_EVHANDLER_COALESCE == cx->mode ) {
+        r = evhandle_coalesce_rest( ecx, w->buf, w->frame_size, cx->ach_options );
+    } else {
+        sns_time_cache_update();
+        r = evhandle_dispatch( cx, w->buf, w->frame_size );
+        sns_time_cache_clear();
+        if( SNS_EVHANDLER_DRAIN == cx->mode ) {
+            r = evhandle_drain_rest( ecx, r, cx->ach_options );
+        }
+    }
+    aa_mem_region_local_pop(mark);
+    return r;
+}
+
+/* Handle a ready channel of the epoll set */
+static enum ach_status
+evhandle_ready( struct evhandle_watch *w )
+{
+    struct evhandle_cx *ecx = w->ecx;
+    int ach_options = ecx->handler->ach_options & ~ACH_O_WAIT;
+
+    if( w->direct ) {
+        /* level triggered, so frames left unread wake us again */
+        return ecx->queue ?
+            pool_enqueue( ecx, ach_options ) :
+            sns_evhandle_impl( ecx, NULL, ach_options );
+    }
+
+    uint64_t count;
+    while( read( w->efd, &count, sizeof(count) ) < 0 && EINTR == errno );
+    SNS_REQUIRE( ach_status_match(w->status, ACH_MASK_OK | ACH_MASK_MISSED_FRAME),
+                 "Could not handle events: %s\n",
+                 ach_result_to_string(w->status) );
+    enum ach_status r = evhandle_received( w );
+    sem_post( &w->ack );
+    return r;
+}
+
+static int
+evhandle_epoll_ctl( int epfd, int fd, void *ptr )
+{
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+    return epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &ev );
+}
+
+static void
+evhandle_epoll_add( int epfd, int fd, void *ptr )
+{
+    SNS_REQUIRE( 0 == evhandle_epoll_ctl( epfd, fd, ptr ),
+                 "Could not add to epoll set: %s\n", strerror(errno) );
+}
+
+int
+sns_evhandle_pollable( const ach_channel_t *channel )
+{
+    /* kernel channels are character devices; shared memory channels
+     * are regular files, which epoll does not support */
+    struct stat st;
+    return channel->fd >= 0 && 0 == fstat( channel->fd, &st ) && S_ISCHR( st.st_mode );
+}
+
+/* Add the descriptor of a channel to the epoll set.  Returns false if
+ * it has none that epoll supports, as for the shared memory file of a
+ * channel in process memory. */
+static int
+evhandle_epoll_channel( int epfd, ach_channel_t *channel, void *ptr )
+{
+    if( !sns_evhandle_pollable(channel) ) return 0;
+    SNS_REQUIRE( 0 == evhandle_epoll_ctl( epfd, channel->fd, ptr ),
+                 "Could not add channel to epoll set: %s\n", strerror(errno) );
+    return 1;
+}
+
+static int
+evhandle_eventfd( void )
+{
+    int fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+    SNS_REQUIRE( fd >= 0, "Could not create eventfd: %s\n", strerror(errno) );
+    return fd;
+}
+
+/* Arm the timerfd for the next scheduled release, or disarm it */
+static void
+evhandle_timer_arm( int tfd, const struct evhandle_periodic_cx *timed )
+{
+    struct itimerspec its;
+    memset( &its, 0, sizeof(its) );
+    if( evhandle_release( timed, &its.it_value ) &&
+        0 == its.it_value.tv_sec && 0 == its.it_value.tv_nsec )
+    {
+        /* zero would disarm */
+        its.it_value.tv_nsec = 1;
+    }
+    SNS_REQUIRE( 0 == timerfd_settime( tfd, TFD_TIMER_ABSTIME, &its, NULL ),
+                 "Could not set timer: %s\n", strerror(errno) );
+}
+
+static void
+evhandle_epoll( struct evhandle_cx *cx, size_t n, struct evhandle_periodic_cx *timed )
+{
+    const struct sns_evhandle_opts *opts = timed->opts;
+    int on_input = opts->periodic_handler && (opts->options & ACH_EV_O_PERIODIC_INPUT);
+
+    int epfd = epoll_create1( EPOLL_CLOEXEC );
+    SNS_REQUIRE( epfd >= 0, "Could not create epoll set: %s\n", strerror(errno) );
+
+    int tfd = -1;
+    if( evhandle_scheduled(timed) ) {
+        tfd = timerfd_create( SNS_CLOCK, TFD_CLOEXEC | TFD_NONBLOCK );
+        SNS_REQUIRE( tfd >= 0, "Could not create timer: %s\n", strerror(errno) );
+        evhandle_epoll_add( epfd, tfd, &tfd );
+    }
+
+    /* Signaled on cancel and when a watcher exits */
+    int stop_fd = evhandle_eventfd();
+    evhandle_epoll_add( epfd, stop_fd, &stop_fd );
+    sns_sigcancel_notify( stop_fd );
+
+    /* Add channels, starting watchers for those without a descriptor */
+    struct evhandle_watch watch[n];
+    size_t n_watch = 0;
+    for( size_t i = 0; i < n; i ++ ) {
+        if( SNS_EVHANDLER_THREAD_DEDICATED == cx[i].handler->thread ) continue;
+        struct evhandle_watch *w = watch + n_watch++;
+        w->ecx = cx + i;
+        w->efd = -1;
+        w->stop_fd = stop_fd;
+        w->direct = evhandle_epoll_channel( epfd, cx[i].handler->channel, w );
+        if( w->direct ) continue;
+        if( NULL == cx[i].queue ) {
+            w->efd = evhandle_eventfd();
+            evhandle_epoll_add( epfd, w->efd, w );
+        }
+        sem_init( &w->ack, 0, 0 );
+        int e = pthread_create( &w->thread, NULL, evhandle_watcher, w );
+        SNS_REQUIRE( 0 == e, "Could not create watcher thread: %s\n", strerror(e) );
+    }
+
+    struct epoll_event events[EVHANDLE_EPOLL_EVENTS];
+    while( !sns_cx.shutdown ) {
+        if( tfd >= 0 ) evhandle_timer_arm( tfd, timed );
+
+        int k = epoll_wait( epfd, events, EVHANDLE_EPOLL_EVENTS, -1 );
+        if( sns_cx.shutdown ) break;
+        if( k < 0 ) {
+            SNS_REQUIRE( EINTR == errno, "Could not wait for events: %s\n", strerror(errno) );
+            continue;
+        }
+
+        int input = 0;
+        for( int j = 0; j < k && !sns_cx.shutdown; j ++ ) {
+            void *ptr = events[j].data.ptr;
+            uint64_t count;
+            if( &tfd == ptr ) {
+                /* expirations; the schedule decides what is due */
+                while( read( tfd, &count, sizeof(count) ) < 0 && EINTR == errno );
+            } else if( &stop_fd == ptr ) {
+                /* a watcher stopped without a shutdown */
+                SNS_REQUIRE( sns_cx.shutdown, "Watcher thread stopped\n" );
+            } else {
+                errno = 0;
+                evhandle_check( evhandle_ready( (struct evhandle_watch *) ptr ) );
+                input = 1;
+            }
+        }
+        if( sns_cx.shutdown ) break;
+
+        if( input && on_input ) {
+            evhandle_periodic_check( evhandle_periodic_run(opts) );
+        }
+        evhandle_periodic_check( evhandle_timed(timed) );
+    }
+
+    /* Stop watchers */
+    for( size_t i = 0; i < n_watch; i ++ ) {
+        if( watch[i].direct ) continue;
+        ach_cancel( watch[i].ecx->handler->channel, NULL );
+        sem_post( &watch[i].ack );
+        pthread_join( watch[i].thread, NULL );
+        sem_destroy( &watch[i].ack );
+        if( watch[i].efd >= 0 ) close( watch[i].efd );
+    }
+    sns_sigcancel_notify( -1 );
+    close( stop_fd );
+    if( tfd >= 0 ) close( tfd );
+    close( epfd );
+}
 
 enum ach_status ACH_WARN_UNUSED
 sns_evhandle( struct sns_evhandler *handlers,
@@ -80,50 +1521,154 @@ sns_evhandle( struct sns_evhandler *handlers,
               int *cancel_sigs,
               int options )
 {
-    /* Create ach handlers */
+    struct sns_evhandle_opts opts;
+    memset( &opts, 0, sizeof(opts) );
+    opts.period = period;
+    opts.periodic_handler = periodic_handler;
+    opts.periodic_context = periodic_context;
+    opts.cancel_sigs = cancel_sigs;
+    opts.options = options;
+    return sns_evhandle_run( handlers, n, &opts );
+}
+
+enum ach_status ACH_WARN_UNUSED
+sns_evhandle_run( struct sns_evhandler *handlers,
+                  size_t n,
+                  const struct sns_evhandle_opts *opts )
+{
+    const struct timespec *period = opts->period;
+
+    for( size_t i = 0; i < n; i ++ ) {
+        if( SNS_EVHANDLER_COALESCE == handlers[i].mode &&
+            NULL == handlers[i].coalesce_handler )
+        {
+            SNS_LOG( LOG_ERR, "No coalesce_handler for coalescing handler %"PRIuPTR"\n", i );
+            return ACH_EINVAL;
+        }
+    }
+
+    /* Absolute-deadline schedule for the periodic handler */
+    struct sns_periodic sched_local;
+    struct sns_periodic *sched = NULL;
+    if( opts->periodic_handler && (opts->options & ACH_EV_O_PERIODIC_TIMEOUT) ) {
+        if( opts->periodic ) {
+            sched = opts->periodic;
+        } else if( period ) {
+            sns_periodic_init( &sched_local, period, SNS_PERIODIC_SKIP );
+            sched = &sched_local;
+        }
+    }
+
+    /* Statistics messages */
+    struct sns_periodic stats_sched;
+    struct evhandle_periodic_cx timed = {
+        .opts = opts,
+        .sched = sched,
+        .timers = opts->timers,
+        .stats = NULL,
+        .handlers = handlers,
+        .n = n };
+    if( opts->stats_channel && opts->stats_period ) {
+        sns_periodic_init( &stats_sched, opts->stats_period, SNS_PERIODIC_SKIP );
+        timed.stats = &stats_sched;
+    }
+
     /* Install cancel handler */
-    if( cancel_sigs ) {
+    if( opts->cancel_sigs ) {
         ach_channel_t *chans[n+1];
         for( size_t i = 0; i < n; i ++ ) {
             chans[i] = handlers[i].channel;
         }
         chans[n] = NULL;
-        sns_sigcancel(chans, cancel_sigs);
+        sns_sigcancel(chans, opts->cancel_sigs);
     }
 
-    if( n == 1 ) {
-        /* special case single channel so we can handle userspace */
-        while( !sns_cx.shutdown) {
-            errno = 0;
-            enum ach_status r = sns_evhandle_impl( handlers, handlers->channel,
-                                                   period, handlers->ach_options | ACH_O_RELTIME | ACH_O_WAIT );
-            if(sns_cx.shutdown) break;
-            SNS_REQUIRE( ACH_OK == r,
-                         "Could not handle events: %s, %s\n",
-                         ach_result_to_string(r),
-                         strerror(errno) );
+    /* Receive buffers */
+    struct evhandle_cx cx[n];
+    size_t n_main = 0, n_dedicated = 0, n_pool = 0;
+    for( size_t i = 0; i < n; i ++ ) {
+        cx[i].handler = handlers + i;
+        cx[i].queue = NULL;
+        cx[i].pool = NULL;
+        cx[i].rt = handlers[i].rt ? handlers[i].rt : opts->rt;
+        sns_msg_recv_init( &cx[i].recv, handlers[i].channel, 0 );
+        switch( handlers[i].thread ) {
+        case SNS_EVHANDLER_THREAD_MAIN:      n_main++;      break;
+        case SNS_EVHANDLER_THREAD_DEDICATED: n_dedicated++; break;
+        case SNS_EVHANDLER_THREAD_POOL:      n_pool++;      break;
+        }
+    }
+
+    /* Worker pool */
+    struct evhandle_pool pool;
+    struct evhandle_queue queue[n_pool ? n_pool : 1];
+    if( n_pool ) {
+        size_t n_workers = opts->pool_threads;
+        if( 0 == n_workers ) {
+            long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+            n_workers = (ncpu > 0) ? (size_t)ncpu : 1;
         }
+        if( n_workers > n_pool ) n_workers = n_pool;
+        pool_start( &pool, n_pool, n_workers, opts->rt );
+        for( size_t i = 0, j = 0; i < n; i ++ ) {
+            if( SNS_EVHANDLER_THREAD_POOL == handlers[i].thread ) {
+                queue_init( queue + j );
+                cx[i].queue = queue + j++;
+                cx[i].pool = &pool;
+            }
+        }
+    }
+
+    /* Dedicated threads */
+    pthread_t dedicated[n_dedicated ? n_dedicated : 1];
+    for( size_t i = 0, j = 0; i < n; i ++ ) {
+        if( SNS_EVHANDLER_THREAD_DEDICATED == handlers[i].thread ) {
+            int e = pthread_create( dedicated + j++, NULL, evhandle_dedicated, cx + i );
+            SNS_REQUIRE( 0 == e, "Could not create handler thread: %s\n", strerror(e) );
+        }
+    }
 
+    /* Main thread: its own handlers plus receiving for the pool */
+    size_t n_ach = n_main + n_pool;
+    if( 0 == n_ach ) {
+        evhandle_idle( &timed );
+    } else if( 1 == n_ach && 1 == n_main ) {
+        /* special case single channel so we can handle userspace */
+        struct evhandle_cx *ecx = cx;
+        while( SNS_EVHANDLER_THREAD_MAIN != ecx->handler->thread ) ecx++;
+        evhandle_single( ecx, &timed );
+    } else if( SNS_EVHANDLE_BACKEND_EPOLL == opts->backend ) {
+        evhandle_epoll( cx, n, &timed );
     } else {
-        /* multiple channels, use ach event loop */
-        struct ach_evhandler ach_handlers[n];
+        evhandle_ach( cx, n, n_ach, &timed );
+    }
+
+    /* Stop other threads */
+    for( size_t i = 0, j = 0; i < n; i ++ ) {
+        if( SNS_EVHANDLER_THREAD_DEDICATED == handlers[i].thread ) {
+            ach_cancel( handlers[i].channel, NULL );
+            pthread_join( dedicated[j++], NULL );
+        }
+    }
+    if( n_pool ) {
+        pool_stop( &pool );
         for( size_t i = 0; i < n; i ++ ) {
-            ach_handlers[i].context = handlers + i;
-            ach_handlers[i].channel = handlers[i].channel;
-            ach_handlers[i].handler = sns_evhandle_fun;
+            if( cx[i].queue ) {
+                if( cx[i].queue->dropped ) {
+                    SNS_LOG( LOG_NOTICE, "Dropped %"PRIu64" queued messages for slow handler %"PRIuPTR"\n",
+                             cx[i].queue->dropped, i );
+                }
+                queue_destroy( cx[i].queue );
+            }
         }
+    }
 
-        while( !sns_cx.shutdown) {
-            errno = 0;
-            enum ach_status r = ach_evhandle( ach_handlers, n,
-                                              period, periodic_handler, periodic_context,
-                                              options );
-            if(sns_cx.shutdown) break;
-            SNS_REQUIRE( ACH_OK == r,
-                         "Could not handle events: %s, %s\n",
-                         ach_result_to_string(r),
-                         strerror(errno) );
+    for( size_t i = 0; i < n; i ++ ) {
+        if( handlers[i].skipped ) {
+            SNS_LOG( LOG_NOTICE, "Skipped %"PRIu64" stale messages for handler %"PRIuPTR"\n",
+                     handlers[i].skipped, i );
         }
+        sns_msg_recv_destroy( &cx[i].recv );
     }
 
     return ACH_OK;
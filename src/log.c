@@ -0,0 +1,856 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdarg.h>
+#include "sns.h"
+
+
+/*---- Packed arguments ----*/
+
+/* Length modifiers of a conversion */
+enum log_len {
+    LOG_LEN_NONE = 0,
+    LOG_LEN_HH,
+    LOG_LEN_H,
+    LOG_LEN_L,
+    LOG_LEN_LL,
+    LOG_LEN_J,
+    LOG_LEN_Z,
+    LOG_LEN_T,
+    LOG_LEN_BIG_L
+};
+
+/* A parsed conversion specification */
+struct log_spec {
+    const char *start;      ///< the '%'
+    const char *len_at;     ///< start of the length modifier
+    const char *end;        ///< one past the conversion character
+    enum log_len len;
+    int n_star;             ///< '*' width and precision arguments
+    int prec_star;          ///< precision is the last '*' argument
+    long prec;              ///< precision, negative if none
+    char conv;
+};
+
+/* Parse the conversion at p, which follows a '%'.  Returns NULL for
+ * conversions that cannot be packed. */
+static const char *
+log_spec_parse( const char *p, struct log_spec *s )
+{
+    s->start = p - 1;
+    s->n_star = 0;
+    s->prec_star = 0;
+    s->prec = -1;
+
+    /* flags */
+    while( *p && strchr("-+ #0'", *p) ) p++;
+    /* width */
+    if( '*' == *p ) {
+        s->n_star++;
+        p++;
+    } else {
+        while( *p >= '0' && *p <= '9' ) p++;
+    }
+    /* precision */
+    if( '.' == *p ) {
+        p++;
+        if( '*' == *p ) {
+            s->n_star++;
+            s->prec_star = 1;
+            p++;
+        } else {
+            s->prec = 0;
+            while( *p >= '0' && *p <= '9' ) {
+                if( s->prec < INT_MAX ) s->prec = s->prec * 10 + (*p - '0');
+                p++;
+            }
+        }
+    }
+    /* length */
+    s->len_at = p;
+    switch( *p ) {
+    case 'h':
+        if( 'h' == p[1] ) { s->len = LOG_LEN_HH; p += 2; }
+        else { s->len = LOG_LEN_H; p++; }
+        break;
+    case 'l':
+        if( 'l' == p[1] ) { s->len = LOG_LEN_LL; p += 2; }
+        else { s->len = LOG_LEN_L; p++; }
+        break;
+    case 'j': s->len = LOG_LEN_J; p++; break;
+    case 'z': s->len = LOG_LEN_Z; p++; break;
+    case 't': s->len = LOG_LEN_T; p++; break;
+    case 'L': s->len = LOG_LEN_BIG_L; p++; break;
+    default:  s->len = LOG_LEN_NONE; break;
+    }
+    /* conversion; wide characters, %n, and %m are not packed */
+    if( '\0' == *p || NULL == strchr("diouxXcspfFeEgGaA", *p) ) return NULL;
+    if( ('c' == *p || 's' == *p) && LOG_LEN_NONE != s->len ) return NULL;
+    s->conv = *p++;
+    s->end = p;
+    return p;
+}
+
+static int
+log_conv_signed( char conv )
+{
+    return 'd' == conv || 'i' == conv;
+}
+
+static int
+log_conv_unsigned( char conv )
+{
+    return NULL != strchr( "ouxX", conv );
+}
+
+static int
+log_conv_float( char conv )
+{
+    return NULL != strchr( "fFeEgGaA", conv );
+}
+
+static int
+log_put( uint8_t *buf, size_t size, size_t *off, const void *src, size_t n )
+{
+    if( *off + n > size ) return -1;
+    memcpy( buf + *off, src, n );
+    *off += n;
+    return 0;
+}
+
+static int
+log_put_u64( uint8_t *buf, size_t size, size_t *off, uint64_t x )
+{
+    return log_put( buf, size, off, &x, sizeof(x) );
+}
+
+/* Read a signed integer argument and truncate it to its type */
+static int64_t
+log_arg_signed( enum log_len len, va_list *ap )
+{
+    switch( len ) {
+    case LOG_LEN_HH:     return (signed char)va_arg( *ap, int );
+    case LOG_LEN_H:      return (short)va_arg( *ap, int );
+    case LOG_LEN_L:      return va_arg( *ap, long );
+    case LOG_LEN_LL:     return va_arg( *ap, long long );
+    case LOG_LEN_J:      return va_arg( *ap, intmax_t );
+    case LOG_LEN_Z:      return va_arg( *ap, ssize_t );
+    case LOG_LEN_T:      return va_arg( *ap, ptrdiff_t );
+    case LOG_LEN_NONE:
+    case LOG_LEN_BIG_L:  break;
+    }
+    return va_arg( *ap, int );
+}
+
+/* Read an unsigned integer argument and truncate it to its type */
+static uint64_t
+log_arg_unsigned( enum log_len len, va_list *ap )
+{
+    switch( len ) {
+    case LOG_LEN_HH:     return (unsigned char)va_arg( *ap, unsigned );
+    case LOG_LEN_H:      return (unsigned short)va_arg( *ap, unsigned );
+    case LOG_LEN_L:      return va_arg( *ap, unsigned long );
+    case LOG_LEN_LL:     return va_arg( *ap, unsigned long long );
+    case LOG_LEN_J:      return va_arg( *ap, uintmax_t );
+    case LOG_LEN_Z:      return va_arg( *ap, size_t );
+    case LOG_LEN_T:      return (uint64_t)va_arg( *ap, ptrdiff_t );
+    case LOG_LEN_NONE:
+    case LOG_LEN_BIG_L:  break;
+    }
+    return va_arg( *ap, unsigned );
+}
+
+ssize_t
+sns_log_pack( const char fmt[], va_list ap, void *buf, size_t size )
+{
+    uint8_t *b = (uint8_t*)buf;
+    size_t off = 0;
+    va_list aq;
+    va_copy( aq, ap );
+
+    const char *p = fmt;
+    int r = 0;
+    while( 0 == r && (p = strchr(p, '%')) ) {
+        p++;
+        if( '%' == *p ) {
+            p++;
+            continue;
+        }
+        struct log_spec s;
+        if( NULL == (p = log_spec_parse(p, &s)) ) {
+            r = -1;
+            break;
+        }
+        for( int i = 0; 0 == r && i < s.n_star; i ++ ) {
+            int star = va_arg( aq, int );
+            /* a negative precision is taken as none */
+            if( s.prec_star ) s.prec = star;
+            r = log_put_u64( b, size, &off, (uint64_t)(int64_t)star );
+        }
+        if( r ) break;
+
+        if( log_conv_signed(s.conv) ) {
+            r = log_put_u64( b, size, &off, (uint64_t)log_arg_signed(s.len, &aq) );
+        } else if( log_conv_unsigned(s.conv) ) {
+            r = log_put_u64( b, size, &off, log_arg_unsigned(s.len, &aq) );
+        } else if( log_conv_float(s.conv) ) {
+            double x = (LOG_LEN_BIG_L == s.len) ?
+                (double)va_arg( aq, long double ) : va_arg( aq, double );
+            r = log_put( b, size, &off, &x, sizeof(x) );
+        } else if( 'c' == s.conv ) {
+            r = log_put_u64( b, size, &off, (uint64_t)(int64_t)va_arg(aq, int) );
+        } else if( 'p' == s.conv ) {
+            r = log_put_u64( b, size, &off, (uint64_t)(uintptr_t)va_arg(aq, void*) );
+        } else {
+            /* strings are copied up to the precision, which need not
+             * be terminated, and terminated */
+            const char *str = va_arg( aq, const char* );
+            if( NULL == str ) str = "(null)";
+            size_t len = (s.prec >= 0) ? strnlen( str, (size_t)s.prec ) : strlen( str );
+            r = log_put( b, size, &off, str, len );
+            if( 0 == r ) r = log_put( b, size, &off, "", 1 );
+        }
+    }
+
+    va_end( aq );
+    return r ? -1 : (ssize_t)off;
+}
+
+static const uint8_t *
+log_get( const uint8_t *p, const uint8_t *end, void *dst, size_t n )
+{
+    if( NULL == p || p + n > end ) return NULL;
+    memcpy( dst, p, n );
+    return p + n;
+}
+
+/* Render one conversion with its '*' arguments */
+#define LOG_SNPRINTF( value )                                           \
+    ( 0 == s.n_star ? snprintf(dst, rem, spec, value) :                 \
+      1 == s.n_star ? snprintf(dst, rem, spec, star[0], value) :        \
+      snprintf(dst, rem, spec, star[0], star[1], value) )
+
+int
+sns_log_render( const char fmt[], const void *buf, size_t size,
+                char *out, size_t n )
+{
+    const uint8_t *b = (const uint8_t*)buf;
+    const uint8_t *end = b + size;
+    size_t k = 0;
+
+    const char *p = fmt;
+    while( *p ) {
+        /* literal text */
+        const char *q = strchr( p, '%' );
+        size_t lit = q ? (size_t)(q - p) : strlen(p);
+        if( k < n ) memcpy( out + k, p, (k + lit < n) ? lit : n - k );
+        k += lit;
+        if( NULL == q ) break;
+
+        p = q + 1;
+        if( '%' == *p ) {
+            if( k < n ) out[k] = '%';
+            k++;
+            p++;
+            continue;
+        }
+        struct log_spec s;
+        if( NULL == (p = log_spec_parse(p, &s)) ) return -1;
+
+        /* Rebuild the conversion for the packed type */
+        char spec[64];
+        size_t n_head = (size_t)(s.len_at - s.start);
+        if( n_head + 4 > sizeof(spec) ) return -1;
+        memcpy( spec, s.start, n_head );
+        size_t j = n_head;
+        if( log_conv_signed(s.conv) || log_conv_unsigned(s.conv) ) {
+            spec[j++] = 'l';
+            spec[j++] = 'l';
+        }
+        spec[j++] = s.conv;
+        spec[j] = '\0';
+
+        int star[2] = {0, 0};
+        for( int i = 0; i < s.n_star; i ++ ) {
+            int64_t x = 0;
+            b = log_get( b, end, &x, sizeof(x) );
+            star[i] = (int)x;
+        }
+
+        char *dst = (k < n) ? out + k : NULL;
+        size_t rem = (k < n) ? n - k : 0;
+        int r;
+        if( log_conv_signed(s.conv) || 'c' == s.conv ) {
+            int64_t x = 0;
+            b = log_get( b, end, &x, sizeof(x) );
+            if( 'c' == s.conv ) r = LOG_SNPRINTF( (int)x );
+            else r = LOG_SNPRINTF( (long long)x );
+        } else if( log_conv_unsigned(s.conv) ) {
+            uint64_t x = 0;
+            b = log_get( b, end, &x, sizeof(x) );
+            r = LOG_SNPRINTF( (unsigned long long)x );
+        } else if( log_conv_float(s.conv) ) {
+            double x = 0;
+            b = log_get( b, end, &x, sizeof(x) );
+            r = LOG_SNPRINTF( x );
+        } else if( 'p' == s.conv ) {
+            uint64_t x = 0;
+            b = log_get( b, end, &x, sizeof(x) );
+            r = LOG_SNPRINTF( (void*)(uintptr_t)x );
+        } else {
+            const char *str = (const char*)b;
+            const void *nul = b ? memchr( b, '\0', (size_t)(end - b) ) : NULL;
+            if( NULL == nul ) return -1;
+            b = (const uint8_t*)nul + 1;
+            r = LOG_SNPRINTF( str );
+        }
+        if( NULL == b || r < 0 ) return -1;
+        k += (size_t)r;
+    }
+
+    if( n > 0 ) out[(k < n) ? k : n - 1] = '\0';
+    return (int)k;
+}
+
+
+/*---- Publishing ----*/
+
+/* Where sns_event() prints instead of publishing, or NULL */
+static FILE *
+log_stderr( void )
+{
+    return sns_cx.is_initialized ? sns_cx.stderr : stderr;
+}
+
+/* Send rendered text as a log message stamped with time */
+static void
+log_publish( int level, const struct timespec *time, const char *text )
+{
+    FILE *err = log_stderr();
+    if( err ) {
+        fputs( text, err );
+        return;
+    }
+
+    size_t size = strlen( text );
+    uint32_t n_str = (uint32_t)size + 1 + 1; /* maybe add trailing newline */
+    size_t n_msg = sns_msg_log_size_n(n_str);
+    sns_msg_log_t *msg = (sns_msg_log_t*)alloca(n_msg);
+    memset( &msg->header, 0, sizeof(msg->header) );
+    sns_msg_header_fill( &msg->header );
+    msg->header.sec = time->tv_sec;
+    msg->header.nsec = (uint32_t)time->tv_nsec;
+    msg->header.n = n_str;
+    msg->priority = level;
+    memcpy( msg->text, text, size + 1 );
+    if( 0 == size || '\n' != msg->text[size-1] ) {
+        msg->text[size] = '\n';
+        msg->text[size+1] = '\0';
+    }
+
+    enum ach_status r = sns_msg_put( &sns_cx.chan_log, &msg->header, n_msg );
+    if( ACH_OK != r ) {
+        syslog( LOG_ALERT, "Could not put log message: %s\n", ach_result_to_string(r) );
+        syslog( level, "%s", msg->text );
+    }
+}
+
+
+/*---- Rate limiting ----*/
+
+/* Sites that have suppressed messages, pushed once and never removed */
+static struct sns_log_site *log_sites = NULL;
+
+static int64_t
+log_now_ns( void )
+{
+    struct timespec now = sns_now();
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Log the suppressed count of site if due or forced */
+static void
+log_site_summarize( struct sns_log_site *site, int64_t now, int force )
+{
+    if( !force &&
+        now - __atomic_load_n(&site->summary_ns, __ATOMIC_RELAXED) < SNS_LOG_SUMMARY_NS )
+    {
+        return;
+    }
+    uint64_t n = __atomic_exchange_n( &site->suppressed, 0, __ATOMIC_RELAXED );
+    if( 0 == n ) return;
+    __atomic_store_n( &site->summary_ns, now, __ATOMIC_RELAXED );
+    sns_event( site->priority, 0, "%s:%d: %"PRIu64" messages suppressed\n",
+               site->file, site->line, n );
+}
+
+int
+sns_log_site_refill( struct sns_log_site *site, int priority )
+{
+    int64_t now = log_now_ns();
+    int64_t last = __atomic_load_n( &site->refill_ns, __ATOMIC_RELAXED );
+    int64_t elapsed = now - last;
+    int64_t token_ns = 1000000000 / site->rate;
+    if( token_ns < 1 ) token_ns = 1;
+
+    /* First use fills the burst and starts the clock; afterwards, whole
+     * tokens earned since the last refill */
+    int64_t add = (0 == last || elapsed >= site->burst * token_ns) ?
+        site->burst : elapsed / token_ns;
+
+    if( add > 0 ) {
+        __atomic_store_n( &site->refill_ns,
+                          (add >= site->burst) ? now : last + add * token_ns,
+                          __ATOMIC_RELAXED );
+        __atomic_store_n( &site->tokens, add - 1, __ATOMIC_RELAXED );
+        log_site_summarize( site, now, 0 );
+        return 1;
+    }
+
+    site->priority = priority;
+    __atomic_store_n( &site->suppressed,
+                      __atomic_load_n(&site->suppressed, __ATOMIC_RELAXED) + 1,
+                      __ATOMIC_RELAXED );
+    __atomic_store_n( &site->suppressed_total,
+                      __atomic_load_n(&site->suppressed_total, __ATOMIC_RELAXED) + 1,
+                      __ATOMIC_RELAXED );
+
+    if( !__atomic_exchange_n(&site->listed, 1, __ATOMIC_ACQ_REL) ) {
+        /* time the first summary from the start of suppression */
+        __atomic_store_n( &site->summary_ns, now, __ATOMIC_RELAXED );
+        struct sns_log_site *head = __atomic_load_n( &log_sites, __ATOMIC_RELAXED );
+        do {
+            site->next = head;
+        } while( !__atomic_compare_exchange_n(&log_sites, &head, site, 1,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+    }
+    return 0;
+}
+
+static void
+log_summarize( int force )
+{
+    int64_t now = log_now_ns();
+    for( struct sns_log_site *site = __atomic_load_n(&log_sites, __ATOMIC_ACQUIRE);
+         site; site = site->next )
+    {
+        log_site_summarize( site, now, force );
+    }
+}
+
+void
+sns_log_summarize( void )
+{
+    log_summarize( 1 );
+}
+
+uint64_t
+sns_log_suppressed( void )
+{
+    uint64_t n = 0;
+    for( struct sns_log_site *site = __atomic_load_n(&log_sites, __ATOMIC_ACQUIRE);
+         site; site = site->next )
+    {
+        n += __atomic_load_n( &site->suppressed_total, __ATOMIC_RELAXED );
+    }
+    return n;
+}
+
+
+/*---- Packed messages ----*/
+
+static int log_packed = 0;
+
+void
+sns_log_set_packed( int packed )
+{
+    __atomic_store_n( &log_packed, packed ? 1 : 0, __ATOMIC_RELAXED );
+}
+
+static int
+log_is_packed( void )
+{
+    return __atomic_load_n( &log_packed, __ATOMIC_RELAXED );
+}
+
+/* Send a format and packed arguments as a log message stamped with time */
+static enum ach_status
+log_publish_packed( int level, const struct timespec *time,
+                    const char *fmt, const void *args, size_t size )
+{
+    size_t fmt_size = strlen( fmt ) + 1;
+    uint32_t n = (uint32_t)(fmt_size + size);
+    size_t n_msg = sns_msg_log_packed_size_n( n );
+    struct sns_msg_log_packed *msg = (struct sns_msg_log_packed*)alloca( n_msg );
+    memset( &msg->header, 0, sizeof(msg->header) );
+    sns_msg_header_fill( &msg->header );
+    if( time ) {
+        msg->header.sec = time->tv_sec;
+        msg->header.nsec = (uint32_t)time->tv_nsec;
+    }
+    msg->header.n = n;
+    msg->priority = level | SNS_LOG_PACKED;
+    msg->fmt_size = (uint32_t)fmt_size;
+    memcpy( msg->data, fmt, fmt_size );
+    memcpy( msg->data + fmt_size, args, size );
+
+    enum ach_status r = sns_msg_put( &sns_cx.chan_log, &msg->header, n_msg );
+    if( ACH_OK != r ) {
+        syslog( LOG_ALERT, "Could not put log message: %s\n", ach_result_to_string(r) );
+    }
+    return r;
+}
+
+int
+sns_log_packed_vput( int level, const char fmt[], va_list ap )
+{
+    if( !log_is_packed() ) return 0;
+    uint8_t args[SNS_LOG_PACKED_ARGS_MAX];
+    ssize_t size = sns_log_pack( fmt, ap, args, sizeof(args) );
+    if( size < 0 ) return 0;
+    log_publish_packed( level, NULL, fmt, args, (size_t)size );
+    return 1;
+}
+
+const char *
+sns_msg_log_text( const void *buf, size_t frame_size, int *priority )
+{
+    const struct sns_msg_log *msg = (const struct sns_msg_log*)buf;
+    if( frame_size < sns_msg_log_size_n(0) ) return NULL;
+
+    if( !(msg->priority & SNS_LOG_PACKED) ) {
+        if( frame_size < sns_msg_log_size_n(msg->header.n) ) return NULL;
+        *priority = msg->priority;
+        return sns_str_nullterm( msg->text, msg->header.n );
+    }
+
+    const struct sns_msg_log_packed *pmsg = (const struct sns_msg_log_packed*)buf;
+    if( frame_size < sns_msg_log_packed_size_n(0) ||
+        frame_size < sns_msg_log_packed_size_n(pmsg->header.n) ||
+        0 == pmsg->fmt_size || pmsg->fmt_size > pmsg->header.n ||
+        '\0' != pmsg->data[pmsg->fmt_size-1] )
+    {
+        return NULL;
+    }
+    const char *fmt = (const char*)pmsg->data;
+    const uint8_t *args = pmsg->data + pmsg->fmt_size;
+    size_t size = pmsg->header.n - pmsg->fmt_size;
+
+    char tmp[1];
+    int n = sns_log_render( fmt, args, size, tmp, sizeof(tmp) );
+    if( n < 0 ) return NULL;
+    char *text = (char*)aa_mem_region_local_alloc( (size_t)n + 1 );
+    sns_log_render( fmt, args, size, text, (size_t)n + 1 );
+    *priority = pmsg->priority & ~SNS_LOG_PACKED;
+    return text;
+}
+
+
+/*---- Asynchronous logging ----*/
+
+/* Bytes of packed arguments or text in each ring entry */
+#define LOG_ENTRY_DATA 224
+
+struct log_entry {
+    const char *fmt;          ///< NULL when data is rendered text
+    struct timespec time;
+    int32_t level;
+    uint32_t size;
+    uint8_t data[LOG_ENTRY_DATA];
+};
+
+/* Single-producer, single-consumer ring of one thread */
+struct log_ring {
+    uint64_t head __attribute__((aligned(64)));  ///< written by the producer
+    uint64_t dropped;                            ///< written by the producer
+    uint64_t tail __attribute__((aligned(64)));  ///< written by the flusher
+    uint64_t reported;                           ///< dropped entries reported
+    int closed;                                  ///< producer thread exited
+    size_t mask;              ///< entries - 1, kept across restarts
+    struct log_ring *next;
+    struct log_entry *entry;
+};
+
+static struct {
+    pthread_mutex_t mutex;      ///< serializes flushing and retired_dropped
+    struct log_ring *rings;     ///< pushed without the mutex
+    uint64_t retired_dropped;   ///< dropped by rings already freed
+    int running;
+    int stop;
+    size_t entries;
+    struct timespec period;
+    pthread_t flusher;
+    pthread_key_t key;
+} log_async = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static pthread_once_t log_async_once = PTHREAD_ONCE_INIT;
+
+static __thread struct log_ring *log_ring_local = NULL;
+static __thread int log_is_flusher = 0;
+
+static void
+log_ring_close( void *_ring )
+{
+    struct log_ring *ring = (struct log_ring*)_ring;
+    log_ring_local = NULL;
+    __atomic_store_n( &ring->closed, 1, __ATOMIC_RELEASE );
+}
+
+static void
+log_async_key( void )
+{
+    int e = pthread_key_create( &log_async.key, log_ring_close );
+    SNS_REQUIRE( 0 == e, "Could not create log key: %s\n", strerror(e) );
+}
+
+static struct log_ring *
+log_ring_create( void )
+{
+    struct log_ring *ring = NULL;
+    if( posix_memalign((void**)&ring, 64, sizeof(*ring)) ) return NULL;
+    memset( ring, 0, sizeof(*ring) );
+    ring->mask = log_async.entries - 1;
+    ring->entry = (struct log_entry*)calloc( log_async.entries, sizeof(ring->entry[0]) );
+    if( NULL == ring->entry ) {
+        free( ring );
+        return NULL;
+    }
+
+    /* Push without the mutex, which is held while flushing */
+    struct log_ring *head = __atomic_load_n( &log_async.rings, __ATOMIC_RELAXED );
+    do {
+        ring->next = head;
+    } while( !__atomic_compare_exchange_n(&log_async.rings, &head, ring, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+
+    pthread_setspecific( log_async.key, ring );
+    log_ring_local = ring;
+    return ring;
+}
+
+void
+sns_log_async_thread_init( void )
+{
+    if( NULL == log_ring_local &&
+        __atomic_load_n(&log_async.running, __ATOMIC_ACQUIRE) )
+    {
+        log_ring_create();
+    }
+}
+
+int
+sns_log_async_vput( int level, const char fmt[], va_list ap )
+{
+    if( !__atomic_load_n(&log_async.running, __ATOMIC_ACQUIRE) || log_is_flusher ) {
+        return 0;
+    }
+
+    struct log_ring *ring = log_ring_local;
+    if( __builtin_expect(NULL == ring, 0) ) {
+        if( NULL == (ring = log_ring_create()) ) return 0;
+    }
+
+    uint64_t head = ring->head;
+    if( head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask ) {
+        __atomic_store_n( &ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED );
+        return 1;
+    }
+
+    struct log_entry *e = ring->entry + (head & ring->mask);
+    if( sns_time_get(&e->time) ) memset( &e->time, 0, sizeof(e->time) );
+    e->level = level;
+    ssize_t size = sns_log_pack( fmt, ap, e->data, sizeof(e->data) );
+    if( size >= 0 ) {
+        e->fmt = fmt;
+        e->size = (uint32_t)size;
+    } else {
+        /* Unpackable or too long: format now, truncating */
+        va_list aq;
+        va_copy( aq, ap );
+        int n = vsnprintf( (char*)e->data, sizeof(e->data), fmt, aq );
+        va_end( aq );
+        e->fmt = NULL;
+        e->size = (n < 0) ? 0 : (uint32_t)n;
+    }
+
+    __atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE );
+    return 1;
+}
+
+/* Publish the pending entries of a ring, true if it is empty */
+static int
+log_ring_flush( struct log_ring *ring )
+{
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+    for( ; tail != head; tail ++ ) {
+        struct log_entry *e = ring->entry + (tail & ring->mask);
+        char text[1024];
+        if( e->fmt && log_is_packed() && NULL == log_stderr() ) {
+            log_publish_packed( e->level, &e->time, e->fmt, e->data, e->size );
+        } else if( NULL == e->fmt ) {
+            log_publish( e->level, &e->time, (const char*)e->data );
+        } else if( sns_log_render(e->fmt, e->data, e->size, text, sizeof(text)) >= 0 ) {
+            log_publish( e->level, &e->time, text );
+        } else {
+            log_publish( LOG_ERR, &e->time, "Could not render log message\n" );
+        }
+        __atomic_store_n( &ring->tail, tail + 1, __ATOMIC_RELEASE );
+    }
+
+    uint64_t dropped = __atomic_load_n( &ring->dropped, __ATOMIC_RELAXED );
+    if( dropped != ring->reported ) {
+        char text[64];
+        struct timespec now = sns_now();
+        snprintf( text, sizeof(text), "Dropped %"PRIu64" log messages\n",
+                  dropped - ring->reported );
+        log_publish( LOG_WARNING, &now, text );
+        ring->reported = dropped;
+    }
+
+    return tail == __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+}
+
+/* Flush every ring and free those of exited threads.  The list head
+ * may be swapped by a concurrent push, so the first ring is never
+ * unlinked; it is freed once a newer ring is in front of it. */
+static void
+log_flush_all( void )
+{
+    pthread_mutex_lock( &log_async.mutex );
+    struct log_ring **pp = &log_async.rings;
+    struct log_ring *ring;
+    while( (ring = __atomic_load_n(pp, __ATOMIC_ACQUIRE)) ) {
+        int closed = __atomic_load_n( &ring->closed, __ATOMIC_ACQUIRE );
+        if( log_ring_flush(ring) && closed && pp != &log_async.rings ) {
+            *pp = ring->next;
+            log_async.retired_dropped += ring->dropped;
+            free( ring->entry );
+            free( ring );
+        } else {
+            pp = &ring->next;
+        }
+    }
+    pthread_mutex_unlock( &log_async.mutex );
+}
+
+void
+sns_log_async_flush( void )
+{
+    if( NULL == __atomic_load_n(&log_async.rings, __ATOMIC_ACQUIRE) ) return;
+    /* Bounded wait: the mutex may be held by a flusher that is stuck or
+     * by this very thread if it died while flushing */
+    struct timespec deadline;
+    clock_gettime( CLOCK_REALTIME, &deadline );
+    deadline.tv_sec += 1;
+    if( pthread_mutex_timedlock(&log_async.mutex, &deadline) ) return;
+    for( struct log_ring *ring = __atomic_load_n(&log_async.rings, __ATOMIC_ACQUIRE);
+         ring; ring = ring->next )
+    {
+        log_ring_flush( ring );
+    }
+    pthread_mutex_unlock( &log_async.mutex );
+}
+
+static void *
+log_flusher( void *arg )
+{
+    (void)arg;
+    log_is_flusher = 1;
+    struct timespec when = sns_now();
+    while( !__atomic_load_n(&log_async.stop, __ATOMIC_ACQUIRE) ) {
+        log_flush_all();
+        log_summarize( 0 );
+        when = sns_time_add_ns( when, (int64_t)log_async.period.tv_sec * 1000000000 +
+                                log_async.period.tv_nsec );
+        clock_nanosleep( SNS_CLOCK, TIMER_ABSTIME, &when, NULL );
+    }
+    log_flush_all();
+    return NULL;
+}
+
+void
+sns_log_async_start( const struct sns_log_async_opts *opts )
+{
+    if( __atomic_load_n(&log_async.running, __ATOMIC_ACQUIRE) ) return;
+    pthread_once( &log_async_once, log_async_key );
+
+    size_t entries = (opts && opts->entries) ? opts->entries : SNS_LOG_ASYNC_ENTRIES_DEFAULT;
+    log_async.entries = 1;
+    while( log_async.entries < entries ) log_async.entries *= 2;
+
+    if( opts && opts->period ) {
+        log_async.period = *opts->period;
+    } else {
+        log_async.period.tv_sec = 0;
+        log_async.period.tv_nsec = SNS_LOG_ASYNC_PERIOD_NS_DEFAULT;
+    }
+
+    log_async.stop = 0;
+    int e = pthread_create( &log_async.flusher, NULL, log_flusher, NULL );
+    SNS_REQUIRE( 0 == e, "Could not create log flusher: %s\n", strerror(e) );
+    __atomic_store_n( &log_async.running, 1, __ATOMIC_RELEASE );
+}
+
+void
+sns_log_async_stop( void )
+{
+    if( !__atomic_load_n(&log_async.running, __ATOMIC_ACQUIRE) ) return;
+    __atomic_store_n( &log_async.running, 0, __ATOMIC_RELEASE );
+    __atomic_store_n( &log_async.stop, 1, __ATOMIC_RELEASE );
+    pthread_join( log_async.flusher, NULL );
+    /* Producers that passed the running check before it was cleared
+     * may have queued entries after the flusher's last pass */
+    log_flush_all();
+}
+
+uint64_t
+sns_log_async_dropped( void )
+{
+    pthread_mutex_lock( &log_async.mutex );
+    uint64_t n = log_async.retired_dropped;
+    for( struct log_ring *ring = __atomic_load_n(&log_async.rings, __ATOMIC_ACQUIRE);
+         ring; ring = ring->next )
+    {
+        n += __atomic_load_n( &ring->dropped, __ATOMIC_RELAXED );
+    }
+    pthread_mutex_unlock( &log_async.mutex );
+    return n;
+}
@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "sns.h"
+#include "sns/logstore.h"
+
+/* Files start with a magic number, so frame offsets are never zero */
+static const char data_magic[8] = "SNSLOG1";
+static const char index_magic[8] = "SNSIDX2";
+
+/* Frames are aligned in the data file */
+#define FRAME_ALIGN 8
+
+static void
+segment_path( char *buf, size_t n, const char *dir, uint64_t segment, const char *ext )
+{
+    snprintf( buf, n, "%s/segment-%010"PRIu64".%s", dir, segment, ext );
+}
+
+/* Cut a file back to size, keeping errno */
+static void
+truncate_to( int fd, uint64_t size )
+{
+    int e = errno;
+    if( 0 == ftruncate(fd, (off_t)size) ) lseek( fd, (off_t)size, SEEK_SET );
+    errno = e;
+}
+
+/* Write all of iov at size, or cut the file back to size */
+static int
+write_at( int fd, struct iovec *iov, int n_iov, uint64_t size )
+{
+    if( 0 == sns_writev_all(fd, iov, n_iov) ) return 0;
+    truncate_to( fd, size );
+    return -1;
+}
+
+
+/*---- Writing ----*/
+
+/* Write the index header with the time range of the segment */
+static int
+index_header_write( struct sns_logstore *store )
+{
+    struct sns_logstore_index_header h;
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, index_magic, sizeof(h.magic) );
+    h.min_sec = store->min.tv_sec;
+    h.min_nsec = (uint32_t)store->min.tv_nsec;
+    h.max_sec = store->max.tv_sec;
+    h.max_nsec = (uint32_t)store->max.tv_nsec;
+    ssize_t w;
+    do {
+        w = pwrite( store->fd_index, &h, sizeof(h), 0 );
+    } while( w < 0 && EINTR == errno );
+    if( w < 0 ) return -1;
+    if( sizeof(h) != (size_t)w ) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+segment_create( struct sns_logstore *store )
+{
+    char path[PATH_MAX];
+    segment_path( path, sizeof(path), store->dir, store->segment, "log" );
+    store->fd_data = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( store->fd_data < 0 ) return -1;
+
+    segment_path( path, sizeof(path), store->dir, store->segment, "idx" );
+    store->fd_index = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( store->fd_index < 0 ) {
+        close( store->fd_data );
+        store->fd_data = -1;
+        return -1;
+    }
+
+    /* empty range, min after max, until the first append */
+    store->min.tv_sec = 1;
+    store->min.tv_nsec = 0;
+    store->max.tv_sec = 0;
+    store->max.tv_nsec = 0;
+    struct iovec iov = {(void*)data_magic, sizeof(data_magic)};
+    if( sns_writev_all(store->fd_data, &iov, 1) || index_header_write(store) ) {
+        return -1;
+    }
+    if( lseek(store->fd_index, sizeof(struct sns_logstore_index_header), SEEK_SET) < 0 ) {
+        return -1;
+    }
+    store->data_size = sizeof(data_magic);
+    store->index_size = sizeof(struct sns_logstore_index_header);
+
+    /* drop old segments */
+    if( store->keep && store->segment >= store->keep ) {
+        uint64_t old = store->segment - store->keep;
+        segment_path( path, sizeof(path), store->dir, old, "idx" );
+        unlink( path );
+        segment_path( path, sizeof(path), store->dir, old, "log" );
+        unlink( path );
+    }
+    return 0;
+}
+
+static void
+segment_close( struct sns_logstore *store )
+{
+    if( store->fd_data >= 0 ) close( store->fd_data );
+    if( store->fd_index >= 0 ) close( store->fd_index );
+    store->fd_data = -1;
+    store->fd_index = -1;
+}
+
+int
+sns_logstore_open( struct sns_logstore *store, const char *dir,
+                   size_t segment_size, size_t keep )
+{
+    memset( store, 0, sizeof(*store) );
+    store->fd_data = -1;
+    store->fd_index = -1;
+    store->segment_size = segment_size ? segment_size : SNS_LOGSTORE_SEGMENT_SIZE;
+    store->keep = keep;
+
+    if( mkdir(dir, 0755) && EEXIST != errno ) return -1;
+    store->dir = strdup( dir );
+    if( NULL == store->dir ) return -1;
+
+    /* continue after existing segments */
+    uint64_t *segments = NULL;
+    ssize_t n = sns_logstore_list( dir, &segments );
+    if( n < 0 ) return -1;
+    store->segment = n ? segments[n-1] + 1 : 0;
+    free( segments );
+
+    return segment_create( store );
+}
+
+int
+sns_logstore_append( struct sns_logstore *store, size_t n,
+                     const void *const *frames, const size_t *sizes,
+                     const struct timespec *received )
+{
+    static const uint8_t pad[FRAME_ALIGN] = {0};
+    struct timespec now;
+    if( NULL == received && clock_gettime(CLOCK_REALTIME, &now) ) return -1;
+    size_t i = 0;
+    while( i < n ) {
+        if( store->data_size >= store->segment_size ) {
+            segment_close( store );
+            store->segment++;
+            if( segment_create(store) ) return -1;
+        }
+
+        /* one write of each file per chunk of frames */
+        struct sns_logstore_entry entry[IOV_MAX/2];
+        struct iovec iov[IOV_MAX];
+        int n_iov = 0;
+        size_t n_entry = 0;
+        uint64_t offset = store->data_size;
+        struct timespec min = store->min, max = store->max;
+        int widened = 0;
+        for( ; i < n && n_entry < sizeof(entry)/sizeof(entry[0]) &&
+                 offset < store->segment_size; i ++ )
+        {
+            const struct sns_msg_log *msg = (const struct sns_msg_log*)frames[i];
+            if( sizes[i] < sizeof(struct sns_msg_header) + sizeof(int) ) continue;
+
+            struct sns_logstore_entry *e = entry + n_entry++;
+            memset( e, 0, sizeof(*e) );
+            struct timespec t = received ? received[i] : now;
+            e->sec = t.tv_sec;
+            e->nsec = (uint32_t)t.tv_nsec;
+            e->offset = offset;
+            e->size = (uint32_t)sizes[i];
+            e->priority = msg->priority & ~SNS_LOG_PACKED;
+            e->pid = msg->header.from_pid;
+            memcpy( e->ident, msg->header.ident, sizeof(e->ident) );
+
+            if( SNS_TIME_GT(store->min, store->max) ) {
+                store->min = t;
+                store->max = t;
+                widened = 1;
+            } else if( SNS_TIME_GT(store->min, t) ) {
+                store->min = t;
+                widened = 1;
+            }
+            if( SNS_TIME_GT(t, store->max) ) {
+                store->max = t;
+                widened = 1;
+            }
+            e->max_sec = store->max.tv_sec;
+            e->max_nsec = (uint32_t)store->max.tv_nsec;
+
+            size_t n_pad = (FRAME_ALIGN - sizes[i] % FRAME_ALIGN) % FRAME_ALIGN;
+            iov[n_iov].iov_base = (void*)frames[i];
+            iov[n_iov++].iov_len = sizes[i];
+            iov[n_iov].iov_base = (void*)pad;
+            iov[n_iov++].iov_len = n_pad;
+            offset += sizes[i] + n_pad;
+        }
+
+        /* range before entries, so it covers them; data before index,
+         * so entries never point past the data; a partial write, e.g.,
+         * from ENOSPC, is cut off so the files stay consistent for the
+         * next append */
+        struct iovec iox = {entry, n_entry * sizeof(entry[0])};
+        if( widened && index_header_write(store) ) {
+            store->min = min;
+            store->max = max;
+            return -1;
+        }
+        if( write_at(store->fd_data, iov, n_iov, store->data_size) ) return -1;
+        if( write_at(store->fd_index, &iox, 1, store->index_size) ) {
+            truncate_to( store->fd_data, store->data_size );
+            return -1;
+        }
+        store->data_size = offset;
+        store->index_size += iox.iov_len;
+    }
+    return 0;
+}
+
+void
+sns_logstore_close( struct sns_logstore *store )
+{
+    segment_close( store );
+    free( store->dir );
+    store->dir = NULL;
+}
+
+
+/*---- Reading ----*/
+
+static int
+u64_cmp( const void *a, const void *b )
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+ssize_t
+sns_logstore_list( const char *dir, uint64_t **segments )
+{
+    DIR *d = opendir( dir );
+    if( NULL == d ) return -1;
+
+    size_t n = 0, max = 0;
+    uint64_t *s = NULL;
+    struct dirent *ent;
+    while( (ent = readdir(d)) ) {
+        uint64_t id;
+        char ext[4];
+        if( 2 == sscanf(ent->d_name, "segment-%"SCNu64".%3s", &id, ext) &&
+            0 == strcmp(ext, "idx") )
+        {
+            if( n == max ) {
+                max = max ? 2*max : 16;
+                uint64_t *t = (uint64_t*)realloc( s, max * sizeof(s[0]) );
+                if( NULL == t ) {
+                    free( s );
+                    closedir( d );
+                    return -1;
+                }
+                s = t;
+            }
+            s[n++] = id;
+        }
+    }
+    closedir( d );
+
+    qsort( s, n, sizeof(s[0]), u64_cmp );
+    *segments = s;
+    return (ssize_t)n;
+}
+
+static void *
+map_file( const char *path, size_t *size )
+{
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 ) return NULL;
+    struct stat st;
+    void *ptr = NULL;
+    if( 0 == fstat(fd, &st) && st.st_size > 0 ) {
+        ptr = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+        if( MAP_FAILED == ptr ) ptr = NULL;
+        else *size = (size_t)st.st_size;
+    } else {
+        errno = EINVAL;
+    }
+    close( fd );
+    return ptr;
+}
+
+/* Whether the frame of e is a whole message in the data file */
+static int
+entry_valid( const struct sns_logstore_segment *seg,
+             const struct sns_logstore_entry *e )
+{
+    return e->offset >= sizeof(data_magic) &&
+        0 == e->offset % FRAME_ALIGN &&
+        e->size >= sizeof(struct sns_msg_header) &&
+        e->offset <= seg->data_size &&
+        e->size <= seg->data_size - e->offset;
+}
+
+int
+sns_logstore_range( const char *dir, uint64_t segment,
+                    struct timespec *min, struct timespec *max )
+{
+    char path[PATH_MAX];
+    segment_path( path, sizeof(path), dir, segment, "idx" );
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 ) return -1;
+    struct sns_logstore_index_header h;
+    ssize_t r;
+    do {
+        r = pread( fd, &h, sizeof(h), 0 );
+    } while( r < 0 && EINTR == errno );
+    int e = errno;
+    close( fd );
+    if( r < 0 ) {
+        errno = e;
+        return -1;
+    }
+    if( sizeof(h) != (size_t)r || memcmp(h.magic, index_magic, sizeof(h.magic)) ) {
+        errno = EINVAL;
+        return -1;
+    }
+    min->tv_sec = (time_t)h.min_sec;
+    min->tv_nsec = (long)h.min_nsec;
+    max->tv_sec = (time_t)h.max_sec;
+    max->tv_nsec = (long)h.max_nsec;
+    return !SNS_TIME_GT((*min), (*max));
+}
+
+int
+sns_logstore_map( struct sns_logstore_segment *seg, const char *dir,
+                  uint64_t segment )
+{
+    memset( seg, 0, sizeof(*seg) );
+    char path[PATH_MAX];
+
+    segment_path( path, sizeof(path), dir, segment, "log" );
+    seg->data = (const uint8_t*)map_file( path, &seg->data_size );
+    if( NULL == seg->data ) return -1;
+
+    segment_path( path, sizeof(path), dir, segment, "idx" );
+    seg->index_map = map_file( path, &seg->index_map_size );
+    if( NULL == seg->index_map ) {
+        sns_logstore_unmap( seg );
+        return -1;
+    }
+
+    if( seg->data_size < sizeof(data_magic) ||
+        memcmp(seg->data, data_magic, sizeof(data_magic)) ||
+        seg->index_map_size < sizeof(struct sns_logstore_index_header) ||
+        memcmp(seg->index_map, index_magic, sizeof(index_magic)) )
+    {
+        sns_logstore_unmap( seg );
+        errno = EINVAL;
+        return -1;
+    }
+
+    const size_t header = sizeof(struct sns_logstore_index_header);
+    seg->index = (const struct sns_logstore_entry*)
+        ((const uint8_t*)seg->index_map + header);
+    /* stop at entries of a partial write or otherwise not in the data;
+     * offsets only increase, so valid entries are a prefix */
+    size_t lo = 0, hi = (seg->index_map_size - header) / sizeof(seg->index[0]);
+    while( lo < hi ) {
+        size_t mid = lo + (hi - lo) / 2;
+        if( entry_valid(seg, seg->index + mid) ) lo = mid + 1;
+        else hi = mid;
+    }
+    seg->n = lo;
+    return 0;
+}
+
+void
+sns_logstore_unmap( struct sns_logstore_segment *seg )
+{
+    if( seg->data ) munmap( (void*)seg->data, seg->data_size );
+    if( seg->index_map ) munmap( seg->index_map, seg->index_map_size );
+    memset( seg, 0, sizeof(*seg) );
+}
+
+size_t
+sns_logstore_find( const struct sns_logstore_segment *seg,
+                   const struct timespec *time )
+{
+    /* the running maximum is sorted */
+    size_t lo = 0, hi = seg->n;
+    while( lo < hi ) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct sns_logstore_entry *e = seg->index + mid;
+        struct timespec max = {(time_t)e->max_sec, (long)e->max_nsec};
+        if( SNS_TIME_GT((*time), max) ) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
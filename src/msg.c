@@ -46,6 +46,7 @@
 #include <time.h>
 #include <ach.h>
 #include <dlfcn.h>
+#include <sys/stat.h>
 #include <syslog.h>
 #include "sns.h"
 
@@ -67,8 +68,127 @@ sns_msg_local_get( ach_channel_t *chan, void **pbuf, size_t *frame_size,
     return r;
 }
 
+/* Receive buffers are cache-line aligned */
+#define RECV_ALIGN 64
+
+static void recv_grow( struct sns_msg_recv *recv, size_t size )
+{
+    size_t n = recv->size ? recv->size : RECV_ALIGN;
+    while( n < size ) n *= 2;
+
+    free( recv->buf );
+    recv->buf = NULL;
+    recv->size = 0;
+    if( posix_memalign( &recv->buf, RECV_ALIGN, n ) ) {
+        SNS_DIE( "Could not allocate %"PRIuPTR" byte receive buffer\n", n );
+    }
+    recv->size = n;
+}
+
+void
+sns_msg_recv_init( struct sns_msg_recv *recv, ach_channel_t *chan,
+                   size_t size_hint )
+{
+    recv->chan = chan;
+    recv->buf = NULL;
+    recv->size = 0;
+    if( size_hint ) recv_grow( recv, size_hint );
+}
+
+void
+sns_msg_recv_destroy( struct sns_msg_recv *recv )
+{
+    free( recv->buf );
+    recv->buf = NULL;
+    recv->size = 0;
+}
+
+enum ach_status
+sns_msg_recv_get( struct sns_msg_recv *recv, void **pbuf,
+                  size_t *frame_size,
+                  const struct timespec *ACH_RESTRICT abstime,
+                  int options )
+{
+    enum ach_status r = ach_get( recv->chan, recv->buf, recv->size,
+                                 frame_size, abstime, options );
+    /* only happens until we have seen the largest frame, but a larger
+     * one may arrive before the retry */
+    while( ACH_OVERFLOW == r ) {
+        recv_grow( recv, *frame_size );
+        r = ach_get( recv->chan, recv->buf, recv->size,
+                     frame_size, abstime, options );
+    }
+
+    if( ach_status_match(r, ACH_MASK_OK | ACH_MASK_MISSED_FRAME) )
+        *pbuf = recv->buf;
+    return r;
+}
+
+/* Generation of the most recent view on this thread.  Bumped when a
+ * view is handed out and again when it is released. */
+static __thread uint64_t view_generation = 0;
+
+struct view_cx {
+    sns_msg_view_fun *fun;
+    void *cx;
+};
+
+static enum ach_status
+view_transfer( void *cx, void **obj_dst, const void *chan_src, size_t frame_size )
+{
+    struct view_cx *vcx = (struct view_cx*)cx;
+    struct sns_msg_view view;
+    view.buf = chan_src;
+    view.frame_size = frame_size;
+    view.generation = ++view_generation;
+
+    *obj_dst = NULL;
+    enum ach_status r = vcx->fun( vcx->cx, &view );
+
+    view_generation++;
+    return r;
+}
+
+enum ach_status
+sns_msg_view_get( ach_channel_t *chan,
+                  sns_msg_view_fun *fun, void *cx,
+                  size_t *frame_size,
+                  const struct timespec *ACH_RESTRICT abstime,
+                  int options )
+{
+    struct view_cx vcx = {.fun = fun, .cx = cx};
+    void *obj;
+    return ach_xget( chan, view_transfer, &vcx, &obj,
+                     frame_size, abstime, options );
+}
+
+int sns_msg_view_is_valid( const struct sns_msg_view *view )
+{
+    return NULL != view->buf && view->generation == view_generation;
+}
+
+void *sns_msg_view_copy( const struct sns_msg_view *view,
+                         struct aa_mem_region *region )
+{
+    assert( sns_msg_view_is_valid(view) );
+    void *buf = aa_mem_region_alloc( region, view->frame_size );
+    memcpy( buf, view->buf, view->frame_size );
+    return buf;
+}
+
 
 void *sns_msg_plugin_symbol( const char *type, const char *symbol ) {
+    /* Built-in and registered types need no plugin library */
+    {
+        const struct sns_msg_type *t = sns_msg_type_lookup( type );
+        if( t && 0 == strcmp(symbol, "sns_msg_dump") && t->dump ) {
+            return (void*) t->dump;
+        }
+        if( t && 0 == strcmp(symbol, "sns_msg_plot_sample") && t->plot_sample ) {
+            return (void*) t->plot_sample;
+        }
+    }
+
     void *dl_lib;
     {
         const char prefix[] = "libsns_msg_";
@@ -93,7 +213,7 @@ static int ensure_time( struct timespec *now, const struct timespec *arg ) {
         memcpy( now, arg, sizeof(*now) );
         return 0;
     } else {
-        return clock_gettime( ACH_DEFAULT_CLOCK, now );
+        return sns_time_get( now );
     }
 }
 
@@ -120,23 +240,184 @@ void sns_msg_set_time( struct sns_msg_header *msg, const struct timespec *arg, i
 
 void sns_msg_header_fill ( struct sns_msg_header *msg ) {
     // lazily init
-    if( !sns_cx.is_initialized ) sns_init();
+    if( __builtin_expect(!sns_cx.is_initialized, 0) ) sns_init();
 
-    msg->from_pid = sns_cx.pid;
+    /* pid, host, and ident come from the template built by sns_init()
+     * and sns_set_ident(); time and seq are stamped by sns_msg_put() */
+    msg->from_pid = sns_cx.header.from_pid;
+    memcpy( msg->from_host, sns_cx.header.from_host, sizeof(msg->from_host) );
+    memcpy( msg->ident, sns_cx.header.ident, sizeof(msg->ident) );
+}
+
+
+/*---- Sequence Numbers ----*/
 
-    assert( sizeof(msg->from_host) >= SNS_HOSTNAME_LEN ) ;
-    assert( sizeof(sns_cx.host) >= SNS_HOSTNAME_LEN ) ;
-    assert( sizeof(char) == sizeof(uint8_t) );
+/* Per-channel sequence counters for sns_msg_put(), keyed by the
+ * channel rather than the handle, so that all handles to one channel
+ * in this process share one sequence.  Slots are claimed once and
+ * never freed, so lookups need no lock. */
+#define SEQ_TABLE_SIZE 256
 
-    strncpy( msg->from_host, sns_cx.host, SNS_HOSTNAME_LEN );
+/* Identity of a channel: its name, the device of a kernel channel, or
+ * the memory of an anonymous channel */
+struct seq_key {
+    uint64_t id;
+    char name[ACH_CHAN_NAME_MAX+1];
+};
 
-    assert( sizeof(msg->ident) >= SNS_IDENT_LEN ) ;
-    strncpy( msg->ident, sns_cx.ident, SNS_HOSTNAME_LEN );
+enum seq_state {
+    SEQ_EMPTY = 0,
+    SEQ_CLAIMED,        ///< key being written
+    SEQ_READY
+};
 
+static struct {
+    int state;
+    struct seq_key key;
+    uint64_t seq;
+} seq_table[SEQ_TABLE_SIZE];
+
+static int seq_key( ach_channel_t *chan, struct seq_key *key )
+{
+    memset( key, 0, sizeof(*key) );
+    if( chan->shm ) {
+        strncpy( key->name, chan->shm->name, sizeof(key->name) - 1 );
+        if( '\0' == key->name[0] ) key->id = (uint64_t)(uintptr_t)chan->shm;
+        return 0;
+    }
+    /* kernel channel, where the put is a system call anyway */
+    struct stat st;
+    if( fstat(chan->fd, &st) ) return -1;
+    key->id = (uint64_t)st.st_rdev;
+    key->name[0] = '/';
+    return 0;
 }
 
+static uint64_t *seq_counter( ach_channel_t *chan )
+{
+    struct seq_key key;
+    if( seq_key(chan, &key) ) return NULL;
+
+    uint64_t h = key.id;
+    for( const char *c = key.name; *c; c ++ ) h = h * 31 + (uint8_t)*c;
+    h *= 0x9E3779B97F4A7C15ull;
+
+    for( size_t k = 0; k < SEQ_TABLE_SIZE; k ++ ) {
+        size_t i = (size_t)(h + k) & (SEQ_TABLE_SIZE - 1);
+        int state = __atomic_load_n( &seq_table[i].state, __ATOMIC_ACQUIRE );
+        if( SEQ_EMPTY == state ) {
+            if( __atomic_compare_exchange_n( &seq_table[i].state, &state, SEQ_CLAIMED,
+                                             0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+            {
+                seq_table[i].key = key;
+                __atomic_store_n( &seq_table[i].state, SEQ_READY, __ATOMIC_RELEASE );
+                return &seq_table[i].seq;
+            }
+            /* else state is now whoever claimed the slot */
+        }
+        while( SEQ_READY != state ) {
+            state = __atomic_load_n( &seq_table[i].state, __ATOMIC_ACQUIRE );
+        }
+        if( 0 == memcmp(&seq_table[i].key, &key, sizeof(key)) ) {
+            return &seq_table[i].seq;
+        }
+    }
+    return NULL;
+}
+
+uint64_t
+sns_msg_seq_next( ach_channel_t *chan )
+{
+    uint64_t *seq = seq_counter( chan );
+    /* out of counters: leave unsequenced rather than share one */
+    return seq ? __atomic_add_fetch( seq, 1, __ATOMIC_RELAXED ) : 0;
+}
+
+enum ach_status
+sns_msg_put( ach_channel_t *chan, struct sns_msg_header *msg, size_t size )
+{
+    msg->seq = sns_msg_seq_next( chan );
+    if( 0 == msg->sec && 0 == msg->nsec ) {
+        sns_msg_set_time( msg, NULL, msg->dur_nsec );
+    }
+    return ach_put( chan, msg, size );
+}
+
+void sns_msg_tracker_init( struct sns_msg_tracker *tracker )
+{
+    memset( tracker, 0, sizeof(*tracker) );
+    tracker->latency_min_ns = INT64_MAX;
+    tracker->latency_max_ns = INT64_MIN;
+}
+
+void sns_msg_tracker_update( struct sns_msg_tracker *tracker,
+                             const struct sns_msg_header *msg,
+                             const struct timespec *now_arg )
+{
+    tracker->received++;
+
+    /* latency */
+    struct timespec now;
+    if( 0 == ensure_time( &now, now_arg ) ) {
+        int64_t latency = ((int64_t)now.tv_sec - msg->sec) * 1000000000 +
+            ((int64_t)now.tv_nsec - (int64_t)msg->nsec);
+        if( latency < tracker->latency_min_ns ) tracker->latency_min_ns = latency;
+        if( latency > tracker->latency_max_ns ) tracker->latency_max_ns = latency;
+        tracker->latency_sum_ns += latency;
+    }
+
+    /* sequence */
+    if( 0 == msg->seq ) {
+        tracker->unsequenced++;
+        return;
+    }
+
+    size_t i;
+    for( i = 0; i < SNS_MSG_TRACKER_SENDERS; i ++ ) {
+        if( tracker->sender[i].last_seq && msg->from_pid == tracker->sender[i].pid ) break;
+    }
+    if( SNS_MSG_TRACKER_SENDERS == i ) {
+        /* new sender, replacing the oldest */
+        i = tracker->next_sender;
+        tracker->next_sender = (i + 1) % SNS_MSG_TRACKER_SENDERS;
+        tracker->senders++;
+        tracker->sender[i].pid = msg->from_pid;
+        tracker->sender[i].last_seq = msg->seq;
+        return;
+    }
+
+    uint64_t *last_seq = &tracker->sender[i].last_seq;
+    if( msg->seq == *last_seq + 1 ) {
+        *last_seq = msg->seq;
+    } else if( msg->seq > *last_seq ) {
+        tracker->gaps++;
+        tracker->lost += msg->seq - *last_seq - 1;
+        *last_seq = msg->seq;
+    } else if( msg->seq == *last_seq ) {
+        tracker->duplicates++;
+    } else {
+        tracker->reordered++;
+    }
+}
+
+void sns_msg_tracker_log( const struct sns_msg_tracker *tracker,
+                          int priority, const char *name )
+{
+    uint64_t n = tracker->received;
+    /* one site logs every report; keep them out of the rate limit */
+    if( !SNS_LOG_PRIORITY(priority) ) return;
+    sns_event( priority, 0,
+               "%s: %"PRIu64" received, %"PRIu64" lost in %"PRIu64" gaps, "
+               "%"PRIu64" reordered, %"PRIu64" duplicates, "
+               "latency min/mean/max %"PRId64"/%"PRId64"/%"PRId64" ns\n",
+               name, n, tracker->lost, tracker->gaps,
+               tracker->reordered, tracker->duplicates,
+               n ? tracker->latency_min_ns : 0,
+               n ? tracker->latency_sum_ns / (int64_t)n : 0,
+               n ? tracker->latency_max_ns : 0 );
+}
 
-static void dump_header( FILE *out, const struct sns_msg_header *msg, const char *type ) {
+void sns_msg_dump_header( FILE *out, const struct sns_msg_header *msg, const char *type ) {
     int64_t
         h = msg->sec / (60*60),
         m = msg->sec / 60 - h*60,
@@ -170,7 +451,7 @@ void sns_msg_vector_plot_sample(
         *sample_size = msg->header.n;
 }
 void sns_msg_vector_dump ( FILE *out, const struct sns_msg_vector *msg ) {
-    dump_header( out, &msg->header, "vector" );
+    sns_msg_dump_header( out, &msg->header, "vector" );
     for( uint32_t i = 0; i < msg->header.n; i ++ ) {
         fprintf(out, "\t%f", msg->x[i] );
     }
@@ -179,7 +460,7 @@ void sns_msg_vector_dump ( FILE *out, const struct sns_msg_vector *msg ) {
 
 /*---- transform ----*/
 void sns_msg_tf_dump ( FILE *out, const struct sns_msg_tf *msg ) {
-    dump_header( out, &msg->header, "tf" );
+    sns_msg_dump_header( out, &msg->header, "tf" );
     for( uint32_t i = 0; i < msg->header.n; i ++ ) {
         fprintf(out, "\t%d: [%f\t%f\t%f\t%f\t%f\t%f\t%f\t]\n",
                 i,
@@ -230,7 +511,7 @@ void sns_msg_tf_plot_sample(
 }
 
 void sns_msg_wt_tf_dump ( FILE *out, const struct sns_msg_wt_tf *msg ) {
-    dump_header( out, &msg->header, "wt_tf" );
+    sns_msg_dump_header( out, &msg->header, "wt_tf" );
     for( uint32_t i = 0; i < msg->header.n; i ++ ) {
         fprintf(out, "\t%d: (%f) [%f\t%f\t%f\t%f\t%f\t%f\t%f\t]\n",
                 i,
@@ -286,7 +567,7 @@ void sns_msg_wt_tf_plot_sample(
 
 
 void sns_msg_tf_dx_dump ( FILE *out, const struct sns_msg_tf_dx *msg ) {
-    dump_header( out, &msg->header, "tf_dx" );
+    sns_msg_dump_header( out, &msg->header, "tf_dx" );
     for( uint32_t i = 0; i < msg->header.n; i ++ ) {
         fprintf(out,
                 "\t%d: [%f\t%f\t%f\t%f]\t[%f\t%f\t%f\t]\n"
@@ -312,7 +593,7 @@ struct sns_msg_motor_ref *sns_msg_motor_ref_alloc ( uint64_t n ) {
 }
 
 void sns_msg_motor_ref_dump ( FILE *out, const struct sns_msg_motor_ref *msg ) {
-    dump_header( out, &msg->header, "motor_ref" );
+    sns_msg_dump_header( out, &msg->header, "motor_ref" );
     const char *mode = "?";
     switch( msg->mode ) {
     case SNS_MOTOR_MODE_HALT:       mode = "halt";             break;
@@ -353,7 +634,7 @@ void sns_msg_motor_ref_plot_sample(
 
 /*---- tag_motor_ref ----*/
 void sns_msg_tag_motor_ref_dump ( FILE *out, const struct sns_msg_tag_motor_ref *msg ) {
-    dump_header( out, &msg->header, "tag_motor_ref" );
+    sns_msg_dump_header( out, &msg->header, "tag_motor_ref" );
     const char *mode = "?";
     switch( msg->mode ) {
     case SNS_MOTOR_MODE_HALT:       mode = "halt";             break;
@@ -397,7 +678,7 @@ struct sns_msg_motor_state *sns_msg_motor_state_alloc ( uint32_t n ) {
     return sns_msg_motor_state_heap_alloc(n);
 }
 void sns_msg_motor_state_dump ( FILE *out, const struct sns_msg_motor_state *msg ) {
-    dump_header( out, &msg->header, "motor_state" );
+    sns_msg_dump_header( out, &msg->header, "motor_state" );
     for( uint32_t i = 0; i < msg->header.n; i ++ ) {
         fprintf(out, "\t(%f,%f) ",
                 msg->X[i].pos, msg->X[i].vel );
@@ -435,7 +716,7 @@ void sns_msg_motor_state_plot_sample(
 /*---- joystick ----*/
 
 void sns_msg_joystick_dump ( FILE *out, const struct sns_msg_joystick *msg ) {
-    dump_header( out, &msg->header, "joystick" );
+    sns_msg_dump_header( out, &msg->header, "joystick" );
     fprintf( out, "0x%08"PRIx64, msg->buttons );
     for( uint32_t i = 0; i < msg->header.n; i ++ ) {
         fprintf(out, "\t%f", msg->axis[i] );
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "sns.h"
+
+/* Padded size of a sub-message and its entry prefix */
+static size_t entry_size( size_t size )
+{
+    size_t n = sizeof(struct sns_msg_batch_entry) + size;
+    return (n + SNS_MSG_BATCH_ALIGN - 1) & ~(size_t)(SNS_MSG_BATCH_ALIGN - 1);
+}
+
+/*---- Receiving ----*/
+
+int
+sns_msg_batch_check( const void *buf, size_t frame_size )
+{
+    const struct sns_msg_batch *batch = (const struct sns_msg_batch*)buf;
+    if( frame_size < SNS_MSG_BATCH_SIZE_0 ||
+        !sns_msg_is_batch(buf, frame_size) ||
+        SNS_MSG_BATCH_MAGIC != batch->magic ||
+        frame_size - SNS_MSG_BATCH_SIZE_0 < batch->size )
+    {
+        return 0;
+    }
+
+    /* entries must exactly tile the data */
+    size_t offset = 0;
+    uint32_t n = 0;
+    while( offset < batch->size ) {
+        if( batch->size - offset < sizeof(struct sns_msg_batch_entry) ) return 0;
+        const struct sns_msg_batch_entry *e =
+            (const struct sns_msg_batch_entry*)(batch->data + offset);
+        if( e->size < sizeof(struct sns_msg_header) ||
+            e->size > batch->size - offset - sizeof(*e) )
+        {
+            return 0;
+        }
+        offset += entry_size( (size_t)e->size );
+        n++;
+    }
+    return offset == batch->size && n == batch->header.n;
+}
+
+const struct sns_msg_header *
+sns_msg_batch_next( const struct sns_msg_batch *batch, size_t *offset, size_t *size )
+{
+    if( *offset >= batch->size ) return NULL;
+
+    const struct sns_msg_batch_entry *e =
+        (const struct sns_msg_batch_entry*)(batch->data + *offset);
+    *size = (size_t)e->size;
+    *offset += entry_size( *size );
+    return (const struct sns_msg_header*)(e + 1);
+}
+
+/*---- Sending ----*/
+
+void
+sns_msg_batcher_init( struct sns_msg_batcher *b, ach_channel_t *chan,
+                      size_t capacity, int64_t max_delay_ns )
+{
+    SNS_REQUIRE( capacity > SNS_MSG_BATCH_SIZE_0,
+                 "Batch capacity of %"PRIuPTR" bytes is too small\n", capacity );
+
+    b->chan = chan;
+    b->capacity = capacity;
+    b->max_delay_ns = max_delay_ns;
+    b->deadline.tv_sec = 0;
+    b->deadline.tv_nsec = 0;
+
+    void *buf = NULL;
+    if( posix_memalign( &buf, 64, capacity ) ) {
+        SNS_DIE( "Could not allocate %"PRIuPTR" byte batch\n", capacity );
+    }
+    b->batch = (struct sns_msg_batch*)buf;
+    memset( b->batch, 0, SNS_MSG_BATCH_SIZE_0 );
+    b->batch->magic = SNS_MSG_BATCH_MAGIC;
+}
+
+void
+sns_msg_batcher_destroy( struct sns_msg_batcher *b )
+{
+    free( b->batch );
+    b->batch = NULL;
+}
+
+enum ach_status
+sns_msg_batcher_flush( struct sns_msg_batcher *b )
+{
+    struct sns_msg_batch *batch = b->batch;
+    if( 0 == batch->header.n ) return ACH_OK;
+
+    sns_msg_header_fill( &batch->header );
+    sns_msg_set_time( &batch->header, NULL, 0 );
+    batch->header.flags = SNS_MSG_FLAG_BATCH;
+
+    /* sub-messages carry the sequence numbers */
+    enum ach_status r = ach_put( b->chan, batch, SNS_MSG_BATCH_SIZE_0 + batch->size );
+
+    batch->header.n = 0;
+    batch->size = 0;
+    return r;
+}
+
+enum ach_status
+sns_msg_batcher_poll( struct sns_msg_batcher *b, const struct timespec *now_arg )
+{
+    if( 0 == b->batch->header.n || b->max_delay_ns < 0 ) return ACH_OK;
+
+    struct timespec now;
+    if( now_arg ) now = *now_arg;
+    else if( sns_time_get(&now) ) return ACH_OK;
+
+    if( SNS_TIME_GT(b->deadline, now) ) return ACH_OK;
+    return sns_msg_batcher_flush( b );
+}
+
+enum ach_status
+sns_msg_batcher_add( struct sns_msg_batcher *b,
+                     struct sns_msg_header *msg, size_t size )
+{
+    struct sns_msg_batch *batch = b->batch;
+    size_t n = entry_size( size );
+
+    /* too big to ever batch */
+    if( SNS_MSG_BATCH_SIZE_0 + n > b->capacity ) {
+        enum ach_status r = sns_msg_batcher_flush( b );
+        if( ACH_OK != r ) return r;
+        return sns_msg_put( b->chan, msg, size );
+    }
+
+    /* make room */
+    if( SNS_MSG_BATCH_SIZE_0 + batch->size + n > b->capacity ) {
+        enum ach_status r = sns_msg_batcher_flush( b );
+        if( ACH_OK != r ) return r;
+    }
+
+    struct timespec now;
+    int have_now = (0 == sns_time_get( &now ));
+
+    msg->seq = sns_msg_seq_next( b->chan );
+    if( 0 == msg->sec && 0 == msg->nsec && have_now ) {
+        msg->sec = now.tv_sec;
+        msg->nsec = (uint32_t)now.tv_nsec;
+    }
+
+    if( 0 == batch->header.n && have_now && b->max_delay_ns >= 0 ) {
+        b->deadline = sns_time_add_ns( now, b->max_delay_ns );
+    }
+
+    struct sns_msg_batch_entry *e =
+        (struct sns_msg_batch_entry*)(batch->data + batch->size);
+    e->size = size;
+    memcpy( e + 1, msg, size );
+    memset( (uint8_t*)(e + 1) + size, 0, n - sizeof(*e) - size );
+    batch->size += (uint32_t)n;
+    batch->header.n++;
+
+    return have_now ? sns_msg_batcher_poll( b, &now ) : ACH_OK;
+}
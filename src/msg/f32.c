@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stddef.h>
+#include "sns.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*---- Scalar conversion ----*/
+
+void sns_real_widen( size_t n, const float *ACH_RESTRICT src, double *ACH_RESTRICT dst )
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for( ; i + 4 <= n; i += 4 ) {
+        __m128 x = _mm_loadu_ps( src + i );
+        _mm_storeu_pd( dst + i,     _mm_cvtps_pd(x) );
+        _mm_storeu_pd( dst + i + 2, _mm_cvtps_pd(_mm_movehl_ps(x, x)) );
+    }
+#endif
+    for( ; i < n; i ++ ) dst[i] = src[i];
+}
+
+void sns_real_narrow( size_t n, const double *ACH_RESTRICT src, float *ACH_RESTRICT dst )
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for( ; i + 4 <= n; i += 4 ) {
+        __m128 lo = _mm_cvtpd_ps( _mm_loadu_pd(src + i) );
+        __m128 hi = _mm_cvtpd_ps( _mm_loadu_pd(src + i + 2) );
+        _mm_storeu_ps( dst + i, _mm_movelh_ps(lo, hi) );
+    }
+#endif
+    for( ; i < n; i ++ ) dst[i] = (float)src[i];
+}
+
+/*---- Plugins ----*/
+
+#define SNS_MSG_F32_PLUGINS( type )                                     \
+    void type ## _dump ( FILE *out, const struct type *msg )            \
+    {                                                                   \
+        sns_msg_schema_dump( out, &type ## _schema, msg );              \
+    }                                                                   \
+    void type ## _plot_sample(                                          \
+        const struct type *msg, double **sample_ptr,                    \
+        char ***sample_labels, size_t *sample_size )                    \
+    {                                                                   \
+        sns_msg_schema_plot_sample( &type ## _schema, msg,              \
+                                    sample_ptr, sample_labels,          \
+                                    sample_size );                      \
+    }
+
+SNS_MSG_F32_PLUGINS( sns_msg_vector_f32 )
+SNS_MSG_F32_PLUGINS( sns_msg_motor_ref_f32 )
+SNS_MSG_F32_PLUGINS( sns_msg_motor_state_f32 )
+
+/*---- Message conversion ----*/
+
+/* Elements are converted as a flat array of scalars: scalars_per_elt
+ * per element.  fixed copies the non-element members. */
+#define SNS_MSG_F32_CONVERT( type, var, scalars_per_elt, fixed )        \
+    void type ## _from_f32( struct type *dst,                           \
+                            const struct type ## _f32 *src )            \
+    {                                                                   \
+        dst->header = src->header;                                      \
+        dst->header.flags &= ~(uint32_t)SNS_MSG_FLAG_F32;               \
+        fixed;                                                          \
+        sns_real_widen( (scalars_per_elt) * src->header.n,              \
+                        (const float*)src->var, (double*)dst->var );    \
+    }                                                                   \
+    void type ## _to_f32( struct type ## _f32 *dst,                     \
+                          const struct type *src )                      \
+    {                                                                   \
+        dst->header = src->header;                                      \
+        dst->header.flags |= SNS_MSG_FLAG_F32;                          \
+        fixed;                                                          \
+        sns_real_narrow( (scalars_per_elt) * src->header.n,             \
+                         (const double*)src->var, (float*)dst->var );   \
+    }                                                                   \
+    struct type *type ## _accept( void *buf, size_t frame_size )        \
+    {                                                                   \
+        if( frame_size < sizeof(struct sns_msg_header) ) return NULL;   \
+        const struct sns_msg_header *h =                                \
+            (const struct sns_msg_header*)buf;                          \
+        if( h->flags & SNS_MSG_FLAG_F32 ) {                             \
+            if( frame_size < type ## _f32_size_n(h->n) ) return NULL;   \
+            struct type *dst = type ## _local_alloc(h->n);              \
+            type ## _from_f32( dst, (const struct type ## _f32*)buf );  \
+            return dst;                                                 \
+        } else if( frame_size < type ## _size_n(h->n) ) {               \
+            return NULL;                                                \
+        } else {                                                        \
+            return (struct type*)buf;                                   \
+        }                                                               \
+    }
+
+SNS_MSG_F32_CONVERT( sns_msg_vector, x, 1, (void)0 )
+SNS_MSG_F32_CONVERT( sns_msg_motor_ref, u, 1, dst->mode = src->mode )
+SNS_MSG_F32_CONVERT( sns_msg_motor_state, X, 2, dst->mode = src->mode )
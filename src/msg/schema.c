@@ -0,0 +1,432 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <inttypes.h>
+#include "sns.h"
+
+/*---- Schemas ----*/
+
+static const struct sns_msg_field log_fixed[] = {
+    SNS_MSG_FIELD( sns_msg_log, priority, SNS_MSG_SCALAR_INT, 1, 0 ),
+    SNS_MSG_FIELD_END };
+static const struct sns_msg_field log_elt[] = {
+    SNS_MSG_ELT_SCALAR( sns_msg_log, text, SNS_MSG_SCALAR_CHAR, 0 ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_log, text, log_fixed, log_elt );
+
+static const struct sns_msg_field vector_elt[] = {
+    SNS_MSG_ELT_SCALAR( sns_msg_vector, x, SNS_MSG_SCALAR_DOUBLE, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_vector, x, NULL, vector_elt );
+
+static const struct sns_msg_field vector_f32_elt[] = {
+    SNS_MSG_ELT_SCALAR( sns_msg_vector_f32, x, SNS_MSG_SCALAR_FLOAT, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_vector_f32, x, NULL, vector_f32_elt );
+
+static const struct sns_msg_field tf_elt[] = {
+    SNS_MSG_ELT_FIELD( sns_msg_tf, tf, r, "q", SNS_MSG_SCALAR_DOUBLE, 4, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_tf, tf, v, "v", SNS_MSG_SCALAR_DOUBLE, 3, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_tf, tf, NULL, tf_elt );
+
+static const struct sns_msg_field wt_tf_elt[] = {
+    SNS_MSG_ELT_FIELD( sns_msg_wt_tf, wt_tf, weight, "weight", SNS_MSG_SCALAR_DOUBLE, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_wt_tf, wt_tf, tf.r, "q", SNS_MSG_SCALAR_DOUBLE, 4, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_wt_tf, wt_tf, tf.v, "v", SNS_MSG_SCALAR_DOUBLE, 3, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_wt_tf, wt_tf, NULL, wt_tf_elt );
+
+static const struct sns_msg_field tf_dx_elt[] = {
+    SNS_MSG_ELT_FIELD( sns_msg_tf_dx, tf_dx, tf.r, "q", SNS_MSG_SCALAR_DOUBLE, 4, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_tf_dx, tf_dx, tf.v, "v", SNS_MSG_SCALAR_DOUBLE, 3, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_tf_dx, tf_dx, dx.dv, "dv", SNS_MSG_SCALAR_DOUBLE, 3, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_tf_dx, tf_dx, dx.omega, "omega", SNS_MSG_SCALAR_DOUBLE, 3, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_tf_dx, tf_dx, NULL, tf_dx_elt );
+
+static const struct sns_msg_field motor_ref_fixed[] = {
+    SNS_MSG_FIELD( sns_msg_motor_ref, mode, SNS_MSG_SCALAR_INT, 1, 0 ),
+    SNS_MSG_FIELD_END };
+static const struct sns_msg_field motor_ref_elt[] = {
+    SNS_MSG_ELT_SCALAR( sns_msg_motor_ref, u, SNS_MSG_SCALAR_DOUBLE, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_motor_ref, u, motor_ref_fixed, motor_ref_elt );
+
+static const struct sns_msg_field motor_ref_f32_fixed[] = {
+    SNS_MSG_FIELD( sns_msg_motor_ref_f32, mode, SNS_MSG_SCALAR_INT, 1, 0 ),
+    SNS_MSG_FIELD_END };
+static const struct sns_msg_field motor_ref_f32_elt[] = {
+    SNS_MSG_ELT_SCALAR( sns_msg_motor_ref_f32, u, SNS_MSG_SCALAR_FLOAT, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_motor_ref_f32, u, motor_ref_f32_fixed, motor_ref_f32_elt );
+
+static const struct sns_msg_field tag_motor_ref_fixed[] = {
+    SNS_MSG_FIELD( sns_msg_tag_motor_ref, mode, SNS_MSG_SCALAR_INT, 1, 0 ),
+    SNS_MSG_FIELD_END };
+static const struct sns_msg_field tag_motor_ref_elt[] = {
+    SNS_MSG_ELT_FIELD( sns_msg_tag_motor_ref, u, val, "val", SNS_MSG_SCALAR_DOUBLE, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_tag_motor_ref, u, priority, "priority", SNS_MSG_SCALAR_UINT64, 1, 0 ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_tag_motor_ref, u, tag_motor_ref_fixed, tag_motor_ref_elt );
+
+static const struct sns_msg_field motor_state_fixed[] = {
+    SNS_MSG_FIELD( sns_msg_motor_state, mode, SNS_MSG_SCALAR_INT, 1, 0 ),
+    SNS_MSG_FIELD_END };
+static const struct sns_msg_field motor_state_elt[] = {
+    SNS_MSG_ELT_FIELD( sns_msg_motor_state, X, pos, "pos", SNS_MSG_SCALAR_DOUBLE, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_motor_state, X, vel, "vel", SNS_MSG_SCALAR_DOUBLE, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_motor_state, X, motor_state_fixed, motor_state_elt );
+
+static const struct sns_msg_field motor_state_f32_fixed[] = {
+    SNS_MSG_FIELD( sns_msg_motor_state_f32, mode, SNS_MSG_SCALAR_INT, 1, 0 ),
+    SNS_MSG_FIELD_END };
+static const struct sns_msg_field motor_state_f32_elt[] = {
+    SNS_MSG_ELT_FIELD( sns_msg_motor_state_f32, X, pos, "pos", SNS_MSG_SCALAR_FLOAT, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_motor_state_f32, X, vel, "vel", SNS_MSG_SCALAR_FLOAT, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_motor_state_f32, X, motor_state_f32_fixed, motor_state_f32_elt );
+
+static const struct sns_msg_field joystick_fixed[] = {
+    SNS_MSG_FIELD( sns_msg_joystick, buttons, SNS_MSG_SCALAR_UINT64, 1, 0 ),
+    SNS_MSG_FIELD_END };
+static const struct sns_msg_field joystick_elt[] = {
+    SNS_MSG_ELT_SCALAR( sns_msg_joystick, axis, SNS_MSG_SCALAR_DOUBLE, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_joystick, axis, joystick_fixed, joystick_elt );
+
+static const struct sns_msg_field sdh_tactile_fixed[] = {
+    SNS_MSG_FIELD( sns_msg_sdh_tactile, cog_x, SNS_MSG_SCALAR_FLOAT, 6, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD( sns_msg_sdh_tactile, cog_y, SNS_MSG_SCALAR_FLOAT, 6, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD( sns_msg_sdh_tactile, area, SNS_MSG_SCALAR_FLOAT, 6, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD( sns_msg_sdh_tactile, force, SNS_MSG_SCALAR_FLOAT, 6, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+static const struct sns_msg_field sdh_tactile_elt[] = {
+    SNS_MSG_ELT_SCALAR( sns_msg_sdh_tactile, x, SNS_MSG_SCALAR_UINT16, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_sdh_tactile, x, sdh_tactile_fixed, sdh_tactile_elt );
+
+static const struct sns_msg_field evstats_elt[] = {
+    SNS_MSG_ELT_FIELD( sns_msg_evstats, stats, frames, "frames",
+                       SNS_MSG_SCALAR_UINT64, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_evstats, stats, missed, "missed",
+                       SNS_MSG_SCALAR_UINT64, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_evstats, stats, bytes, "bytes",
+                       SNS_MSG_SCALAR_UINT64, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_evstats, stats, messages, "messages",
+                       SNS_MSG_SCALAR_UINT64, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_evstats, stats, runtime_max_ns, "runtime_max_ns",
+                       SNS_MSG_SCALAR_INT64, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_evstats, stats, latency_max_ns, "latency_max_ns",
+                       SNS_MSG_SCALAR_INT64, 1, SNS_MSG_FIELD_SAMPLE ),
+    SNS_MSG_ELT_FIELD( sns_msg_evstats, stats, runtime_hist, "runtime_hist",
+                       SNS_MSG_SCALAR_UINT64, SNS_HIST_BINS, 0 ),
+    SNS_MSG_ELT_FIELD( sns_msg_evstats, stats, latency_hist, "latency_hist",
+                       SNS_MSG_SCALAR_UINT64, SNS_HIST_BINS, 0 ),
+    SNS_MSG_FIELD_END };
+SNS_DEF_MSG_SCHEMA( sns_msg_evstats, stats, NULL, evstats_elt );
+
+
+/*---- Scalars ----*/
+
+static size_t scalar_size( enum sns_msg_scalar scalar )
+{
+    switch( scalar ) {
+    case SNS_MSG_SCALAR_DOUBLE: return sizeof(double);
+    case SNS_MSG_SCALAR_FLOAT:  return sizeof(float);
+    case SNS_MSG_SCALAR_INT:    return sizeof(int);
+    case SNS_MSG_SCALAR_INT64:  return sizeof(int64_t);
+    case SNS_MSG_SCALAR_UINT64: return sizeof(uint64_t);
+    case SNS_MSG_SCALAR_UINT16: return sizeof(uint16_t);
+    case SNS_MSG_SCALAR_CHAR:   return sizeof(char);
+    }
+    assert(0);
+    return 0;
+}
+
+static void print_scalar( FILE *out, enum sns_msg_scalar scalar, const void *ptr )
+{
+    switch( scalar ) {
+    case SNS_MSG_SCALAR_DOUBLE: fprintf( out, "%f", *(const double*)ptr ); break;
+    case SNS_MSG_SCALAR_FLOAT:  fprintf( out, "%f", (double)*(const float*)ptr ); break;
+    case SNS_MSG_SCALAR_INT:    fprintf( out, "%d", *(const int*)ptr ); break;
+    case SNS_MSG_SCALAR_INT64:  fprintf( out, "%"PRId64, *(const int64_t*)ptr ); break;
+    case SNS_MSG_SCALAR_UINT64: fprintf( out, "%"PRIu64, *(const uint64_t*)ptr ); break;
+    case SNS_MSG_SCALAR_UINT16: fprintf( out, "%"PRIu16, *(const uint16_t*)ptr ); break;
+    case SNS_MSG_SCALAR_CHAR:   fputc( *(const char*)ptr, out ); break;
+    }
+}
+
+static void print_field( FILE *out, const struct sns_msg_field *f, const uint8_t *base )
+{
+    size_t size = scalar_size( f->scalar );
+    fprintf( out, " %s=", f->name );
+    if( f->count > 1 ) fputc( '[', out );
+    for( size_t k = 0; k < f->count; k ++ ) {
+        if( k ) fputc( ' ', out );
+        print_scalar( out, f->scalar, base + f->offset + k*size );
+    }
+    if( f->count > 1 ) fputc( ']', out );
+}
+
+/*---- Dump ----*/
+
+void sns_msg_schema_dump( FILE *out, const struct sns_msg_schema *schema,
+                          const void *msg )
+{
+    const struct sns_msg_header *header = (const struct sns_msg_header *)msg;
+    const uint8_t *base = (const uint8_t*)msg;
+
+    sns_msg_dump_header( out, header, schema->name );
+
+    if( schema->fixed && schema->fixed->name ) {
+        fputc( '\t', out );
+        for( const struct sns_msg_field *f = schema->fixed; f->name; f++ ) {
+            print_field( out, f, base );
+        }
+        fputc( '\n', out );
+    }
+
+    const uint8_t *elt = base + schema->var_offset;
+    if( SNS_MSG_SCALAR_CHAR == schema->elt[0].scalar && NULL == schema->elt[1].name ) {
+        /* character arrays are text */
+        fprintf( out, "\t%s\n", sns_str_nullterm((const char*)elt, header->n) );
+        return;
+    }
+
+    for( uint32_t i = 0; i < header->n; i ++, elt += schema->elt_size ) {
+        fprintf( out, "\t%"PRIu32":", i );
+        for( const struct sns_msg_field *f = schema->elt; f->name; f++ ) {
+            print_field( out, f, elt );
+        }
+        fputc( '\n', out );
+    }
+}
+
+/*---- Gather ----*/
+
+/* Scalars of one type, from either the fixed fields or each element */
+struct sns_msg_gather_run {
+    enum sns_msg_scalar scalar;   /* scalar type of the run */
+    int elt;                      /* true for array elements */
+    size_t n;                     /* number of scalars */
+    size_t *src;                  /* byte offsets in message or element */
+    size_t *dst;                  /* indices in the sample */
+};
+
+static size_t count_samples( const struct sns_msg_field *fields,
+                             enum sns_msg_scalar scalar )
+{
+    size_t n = 0;
+    for( const struct sns_msg_field *f = fields; f && f->name; f++ ) {
+        if( (f->flags & SNS_MSG_FIELD_SAMPLE) &&
+            (0 == scalar || scalar == f->scalar) )
+        {
+            n += f->count;
+        }
+    }
+    return n;
+}
+
+/* Add one run for each scalar type present in fields */
+static void add_runs( struct sns_msg_gather *gather,
+                      const struct sns_msg_field *fields, int elt,
+                      struct aa_mem_region *region )
+{
+    for( int s = SNS_MSG_SCALAR_DOUBLE; s <= SNS_MSG_SCALAR_CHAR; s ++ ) {
+        enum sns_msg_scalar scalar = (enum sns_msg_scalar)s;
+        size_t n = count_samples( fields, scalar );
+        if( 0 == n ) continue;
+
+        struct sns_msg_gather_run *run = gather->run + gather->n_run++;
+        run->scalar = scalar;
+        run->elt = elt;
+        run->n = 0;
+        run->src = (size_t*)aa_mem_region_alloc( region, n*sizeof(run->src[0]) );
+        run->dst = (size_t*)aa_mem_region_alloc( region, n*sizeof(run->dst[0]) );
+
+        size_t size = scalar_size( scalar );
+        size_t dst = 0;
+        for( const struct sns_msg_field *f = fields; f->name; f++ ) {
+            if( !(f->flags & SNS_MSG_FIELD_SAMPLE) ) continue;
+            for( size_t k = 0; k < f->count; k ++, dst ++ ) {
+                if( f->scalar != scalar ) continue;
+                run->src[run->n] = f->offset + k*size;
+                run->dst[run->n] = dst;
+                run->n++;
+            }
+        }
+        assert( n == run->n );
+    }
+}
+
+void sns_msg_gather_init( struct sns_msg_gather *gather,
+                          const struct sns_msg_schema *schema,
+                          struct aa_mem_region *region )
+{
+    gather->schema = schema;
+    gather->n_fixed = count_samples( schema->fixed, (enum sns_msg_scalar)0 );
+    gather->n_elt = count_samples( schema->elt, (enum sns_msg_scalar)0 );
+    gather->n_run = 0;
+
+    size_t max_run = 2 * (SNS_MSG_SCALAR_CHAR + 1);
+    gather->run = (struct sns_msg_gather_run*)
+        aa_mem_region_alloc( region, max_run * sizeof(gather->run[0]) );
+    if( schema->fixed ) add_runs( gather, schema->fixed, 0, region );
+    add_runs( gather, schema->elt, 1, region );
+}
+
+size_t sns_msg_gather_size( const struct sns_msg_gather *gather, const void *msg )
+{
+    const struct sns_msg_header *header = (const struct sns_msg_header *)msg;
+    return gather->n_fixed + header->n * gather->n_elt;
+}
+
+static void gather_run( const struct sns_msg_gather_run *run,
+                        const uint8_t *src, double *dst )
+{
+    size_t n = run->n;
+    const size_t *s = run->src;
+    const size_t *d = run->dst;
+    switch( run->scalar ) {
+    case SNS_MSG_SCALAR_DOUBLE:
+        for( size_t k = 0; k < n; k ++ ) dst[d[k]] = *(const double*)(src + s[k]);
+        break;
+    case SNS_MSG_SCALAR_FLOAT:
+        for( size_t k = 0; k < n; k ++ ) dst[d[k]] = *(const float*)(src + s[k]);
+        break;
+    case SNS_MSG_SCALAR_INT:
+        for( size_t k = 0; k < n; k ++ ) dst[d[k]] = *(const int*)(src + s[k]);
+        break;
+    case SNS_MSG_SCALAR_INT64:
+        for( size_t k = 0; k < n; k ++ ) dst[d[k]] = (double)*(const int64_t*)(src + s[k]);
+        break;
+    case SNS_MSG_SCALAR_UINT64:
+        for( size_t k = 0; k < n; k ++ ) dst[d[k]] = (double)*(const uint64_t*)(src + s[k]);
+        break;
+    case SNS_MSG_SCALAR_UINT16:
+        for( size_t k = 0; k < n; k ++ ) dst[d[k]] = *(const uint16_t*)(src + s[k]);
+        break;
+    case SNS_MSG_SCALAR_CHAR:
+        for( size_t k = 0; k < n; k ++ ) dst[d[k]] = *(const char*)(src + s[k]);
+        break;
+    }
+}
+
+void sns_msg_gather( const struct sns_msg_gather *gather, const void *msg,
+                     double *sample )
+{
+    const struct sns_msg_header *header = (const struct sns_msg_header *)msg;
+    const uint8_t *base = (const uint8_t*)msg;
+    const struct sns_msg_gather_run *run = gather->run;
+    const struct sns_msg_gather_run *run_end = gather->run + gather->n_run;
+
+    /* fixed fields come first in the plan */
+    for( ; run < run_end && !run->elt; run ++ ) {
+        gather_run( run, base, sample );
+    }
+
+    /* then one strided pass over the elements */
+    const uint8_t *elt = base + gather->schema->var_offset;
+    double *elt_sample = sample + gather->n_fixed;
+    for( uint32_t i = 0; i < header->n; i ++ ) {
+        for( const struct sns_msg_gather_run *r = run; r < run_end; r ++ ) {
+            gather_run( r, elt, elt_sample );
+        }
+        elt += gather->schema->elt_size;
+        elt_sample += gather->n_elt;
+    }
+}
+
+static void field_labels( char **labels, const struct sns_msg_field *fields,
+                          int elt, uint32_t i, struct aa_mem_region *region )
+{
+    size_t j = 0;
+    for( const struct sns_msg_field *f = fields; f && f->name; f++ ) {
+        if( !(f->flags & SNS_MSG_FIELD_SAMPLE) ) continue;
+        for( size_t k = 0; k < f->count; k ++ ) {
+            if( f->count > 1 ) {
+                labels[j++] = elt ?
+                    aa_mem_region_printf( region, "%s[%"PRIuPTR"] %"PRIu32, f->name, k, i ) :
+                    aa_mem_region_printf( region, "%s[%"PRIuPTR"]", f->name, k );
+            } else {
+                labels[j++] = elt ?
+                    aa_mem_region_printf( region, "%s %"PRIu32, f->name, i ) :
+                    aa_mem_region_strdup( region, f->name );
+            }
+        }
+    }
+}
+
+char **sns_msg_gather_labels( const struct sns_msg_gather *gather, const void *msg,
+                              struct aa_mem_region *region )
+{
+    const struct sns_msg_header *header = (const struct sns_msg_header *)msg;
+    size_t n = sns_msg_gather_size( gather, msg );
+    char **labels = (char**)aa_mem_region_alloc( region, n*sizeof(labels[0]) );
+
+    field_labels( labels, gather->schema->fixed, 0, 0, region );
+    for( uint32_t i = 0; i < header->n; i ++ ) {
+        field_labels( labels + gather->n_fixed + i*gather->n_elt,
+                      gather->schema->elt, 1, i, region );
+    }
+    return labels;
+}
+
+void sns_msg_schema_plot_sample( const struct sns_msg_schema *schema,
+                                 const void *msg,
+                                 double **sample_ptr, char ***sample_labels,
+                                 size_t *sample_size )
+{
+    aa_mem_region_t *reg = aa_mem_region_local_get();
+    struct sns_msg_gather gather;
+    sns_msg_gather_init( &gather, schema, reg );
+    size_t n = sns_msg_gather_size( &gather, msg );
+
+    if( sample_ptr ) {
+        *sample_ptr = (double*)aa_mem_region_alloc( reg, n*sizeof((*sample_ptr)[0]) );
+        sns_msg_gather( &gather, msg, *sample_ptr );
+    }
+
+    if( sample_labels ) {
+        *sample_labels = sns_msg_gather_labels( &gather, msg, reg );
+    }
+
+    if( sample_size )
+        *sample_size = n;
+}
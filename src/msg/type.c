@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stddef.h>
+#include <dlfcn.h>
+#include "sns.h"
+
+/*---- Built-in types ----*/
+
+/* Adapt the typed plugin functions to the generic signatures */
+#define SNS_MSG_TYPE_DUMP( type )                                       \
+    static void type ## _dump_any ( FILE *out, void *msg )              \
+    {                                                                   \
+        type ## _dump( out, (const struct type*)msg );                  \
+    }
+
+#define SNS_MSG_TYPE_PLOT_SAMPLE( type )                                \
+    static void type ## _plot_sample_any                                \
+    ( const void *msg, double **sample_ptr,                             \
+      char ***sample_labels, size_t *sample_size )                      \
+    {                                                                   \
+        type ## _plot_sample( (const struct type*)msg,                  \
+                              sample_ptr, sample_labels, sample_size ); \
+    }
+
+#define SNS_MSG_TYPE_PLUGINS( type )            \
+    SNS_MSG_TYPE_DUMP( type )                   \
+    SNS_MSG_TYPE_PLOT_SAMPLE( type )
+
+/* Use the generic schema engine for types without hand-written plugins */
+#define SNS_MSG_TYPE_SCHEMA_DUMP( type )                                \
+    static void type ## _dump_any ( FILE *out, void *msg )              \
+    {                                                                   \
+        sns_msg_schema_dump( out, &type ## _schema, msg );              \
+    }
+
+#define SNS_MSG_TYPE_SCHEMA_PLOT_SAMPLE( type )                         \
+    static void type ## _plot_sample_any                                \
+    ( const void *msg, double **sample_ptr,                             \
+      char ***sample_labels, size_t *sample_size )                      \
+    {                                                                   \
+        sns_msg_schema_plot_sample( &type ## _schema, msg,              \
+                                    sample_ptr, sample_labels,          \
+                                    sample_size );                      \
+    }
+
+/* Registry entry for a type defined with SNS_DEF_MSG_VAR */
+#define SNS_MSG_TYPE_ENTRY( name, type, var, dump, plot_sample )        \
+    { name,                                                             \
+      sizeof(struct type) - sizeof(((struct type*)0)->var[0]),          \
+      sizeof(((struct type*)0)->var[0]),                                \
+      offsetof(struct type, header),                                    \
+      dump, plot_sample,                                                \
+      &type ## _schema }
+
+/* Packed log messages are dumped as their rendered text */
+static void sns_msg_log_dump_any ( FILE *out, void *msg )
+{
+    const struct sns_msg_log *log = (const struct sns_msg_log*)msg;
+    if( !(log->priority & SNS_LOG_PACKED) ) {
+        sns_msg_schema_dump( out, &sns_msg_log_schema, msg );
+        return;
+    }
+
+    int priority;
+    const char *text = sns_msg_log_text( msg, sns_msg_log_packed_size(msg), &priority );
+    if( NULL == text ) {
+        fprintf( out, "invalid packed log message\n" );
+        return;
+    }
+    uint32_t n = (uint32_t)strlen(text) + 1;
+    struct sns_msg_log *copy = (struct sns_msg_log*)
+        aa_mem_region_local_alloc( sns_msg_log_size_n(n) );
+    memcpy( &copy->header, &log->header, sizeof(copy->header) );
+    copy->header.n = n;
+    copy->priority = priority;
+    memcpy( copy->text, text, n );
+    sns_msg_schema_dump( out, &sns_msg_log_schema, copy );
+}
+SNS_MSG_TYPE_PLUGINS( sns_msg_vector )
+SNS_MSG_TYPE_PLUGINS( sns_msg_tf )
+SNS_MSG_TYPE_PLUGINS( sns_msg_wt_tf )
+SNS_MSG_TYPE_DUMP( sns_msg_tf_dx )
+SNS_MSG_TYPE_SCHEMA_PLOT_SAMPLE( sns_msg_tf_dx )
+SNS_MSG_TYPE_PLUGINS( sns_msg_motor_ref )
+SNS_MSG_TYPE_PLUGINS( sns_msg_tag_motor_ref )
+SNS_MSG_TYPE_PLUGINS( sns_msg_motor_state )
+SNS_MSG_TYPE_PLUGINS( sns_msg_joystick )
+SNS_MSG_TYPE_PLUGINS( sns_msg_vector_f32 )
+SNS_MSG_TYPE_PLUGINS( sns_msg_motor_ref_f32 )
+SNS_MSG_TYPE_PLUGINS( sns_msg_motor_state_f32 )
+SNS_MSG_TYPE_SCHEMA_DUMP( sns_msg_sdh_tactile )
+SNS_MSG_TYPE_SCHEMA_PLOT_SAMPLE( sns_msg_sdh_tactile )
+SNS_MSG_TYPE_SCHEMA_DUMP( sns_msg_evstats )
+SNS_MSG_TYPE_SCHEMA_PLOT_SAMPLE( sns_msg_evstats )
+
+static const struct sns_msg_type builtin_types[] = {
+    SNS_MSG_TYPE_ENTRY( "log", sns_msg_log, text,
+                        sns_msg_log_dump_any,
+                        NULL ),
+    SNS_MSG_TYPE_ENTRY( "vector", sns_msg_vector, x,
+                        sns_msg_vector_dump_any,
+                        sns_msg_vector_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "tf", sns_msg_tf, tf,
+                        sns_msg_tf_dump_any,
+                        sns_msg_tf_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "wt_tf", sns_msg_wt_tf, wt_tf,
+                        sns_msg_wt_tf_dump_any,
+                        sns_msg_wt_tf_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "tf_dx", sns_msg_tf_dx, tf_dx,
+                        sns_msg_tf_dx_dump_any,
+                        sns_msg_tf_dx_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "motor_ref", sns_msg_motor_ref, u,
+                        sns_msg_motor_ref_dump_any,
+                        sns_msg_motor_ref_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "tag_motor_ref", sns_msg_tag_motor_ref, u,
+                        sns_msg_tag_motor_ref_dump_any,
+                        sns_msg_tag_motor_ref_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "motor_state", sns_msg_motor_state, X,
+                        sns_msg_motor_state_dump_any,
+                        sns_msg_motor_state_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "joystick", sns_msg_joystick, axis,
+                        sns_msg_joystick_dump_any,
+                        sns_msg_joystick_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "sdh_tactile", sns_msg_sdh_tactile, x,
+                        sns_msg_sdh_tactile_dump_any,
+                        sns_msg_sdh_tactile_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "vector_f32", sns_msg_vector_f32, x,
+                        sns_msg_vector_f32_dump_any,
+                        sns_msg_vector_f32_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "motor_ref_f32", sns_msg_motor_ref_f32, u,
+                        sns_msg_motor_ref_f32_dump_any,
+                        sns_msg_motor_ref_f32_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "motor_state_f32", sns_msg_motor_state_f32, X,
+                        sns_msg_motor_state_f32_dump_any,
+                        sns_msg_motor_state_f32_plot_sample_any ),
+    SNS_MSG_TYPE_ENTRY( "evstats", sns_msg_evstats, stats,
+                        sns_msg_evstats_dump_any,
+                        sns_msg_evstats_plot_sample_any ),
+};
+
+/*---- Hash table ----*/
+
+/* Power of two, comfortably larger than the number of types */
+#define TYPE_TABLE_SIZE 64
+
+static const struct sns_msg_type *type_table[TYPE_TABLE_SIZE];
+static size_t type_count = 0;
+static pthread_mutex_t type_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a */
+static size_t type_hash( const char *name )
+{
+    uint32_t h = 2166136261u;
+    for( const char *c = name; *c; c++ ) {
+        h ^= (uint8_t)*c;
+        h *= 16777619u;
+    }
+    return h & (TYPE_TABLE_SIZE - 1);
+}
+
+/* Find the slot for name, either its entry or the empty slot where it
+ * would go.  Caller holds type_mutex. */
+static const struct sns_msg_type **type_slot( const char *name )
+{
+    size_t i = type_hash(name);
+    while( type_table[i] && strcmp(type_table[i]->name, name) ) {
+        i = (i + 1) & (TYPE_TABLE_SIZE - 1);
+    }
+    return type_table + i;
+}
+
+static int type_insert( const struct sns_msg_type *type )
+{
+    const struct sns_msg_type **slot = type_slot( type->name );
+    if( *slot ) return -1;
+    if( type_count + 1 >= TYPE_TABLE_SIZE ) return -1;
+    *slot = type;
+    type_count++;
+    return 0;
+}
+
+static void type_init( void )
+{
+    static int initialized = 0;
+    if( initialized ) return;
+    for( size_t i = 0; i < sizeof(builtin_types)/sizeof(builtin_types[0]); i ++ ) {
+        type_insert( builtin_types + i );
+    }
+    initialized = 1;
+}
+
+/* Fall back to the dlopen plugin for out-of-tree types */
+static const struct sns_msg_type *type_load_plugin( const char *name )
+{
+    const char prefix[] = "libsns_msg_";
+    const char suffix[] = ".so";
+    char buf[ strlen(prefix) + strlen(suffix) + strlen(name) + 1 ];
+    strcpy(buf,prefix);
+    strcat(buf,name);
+    strcat(buf,suffix);
+
+    void *dl_lib = dlopen(buf, RTLD_NOW);
+    if( NULL == dl_lib ) {
+        SNS_LOG( LOG_DEBUG, "Couldn't open plugin '%s': %s\n", buf, dlerror() );
+        return NULL;
+    }
+
+    struct sns_msg_type *type = AA_NEW0( struct sns_msg_type );
+    type->name = strdup(name);
+    type->dump = (sns_msg_dump_fun*) dlsym( dl_lib, "sns_msg_dump" );
+    type->plot_sample = (sns_msg_plot_sample_fun*) dlsym( dl_lib, "sns_msg_plot_sample" );
+    return type;
+}
+
+int sns_msg_type_register( const struct sns_msg_type *type )
+{
+    pthread_mutex_lock( &type_mutex );
+    type_init();
+    int r = type_insert( type );
+    pthread_mutex_unlock( &type_mutex );
+    return r;
+}
+
+const struct sns_msg_type *sns_msg_type_lookup( const char *name )
+{
+    /* Accept both "motor_ref" and "sns_msg_motor_ref" */
+    const char prefix[] = "sns_msg_";
+    if( 0 == strncmp(name, prefix, sizeof(prefix)-1) ) {
+        name += sizeof(prefix)-1;
+    }
+
+    pthread_mutex_lock( &type_mutex );
+    type_init();
+    const struct sns_msg_type **slot = type_slot( name );
+    if( NULL == *slot ) {
+        const struct sns_msg_type *type = type_load_plugin( name );
+        if( type ) type_insert( type );
+    }
+    const struct sns_msg_type *type = *slot;
+    pthread_mutex_unlock( &type_mutex );
+
+    return type;
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <math.h>
+#include "sns.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const char *sns_msg_invalid_string( enum sns_msg_invalid r )
+{
+    switch( r ) {
+    case SNS_MSG_VALID:             return "valid";
+    case SNS_MSG_INVALID_SIZE:      return "bad size";
+    case SNS_MSG_INVALID_TIME:      return "bad time";
+    case SNS_MSG_INVALID_STRING:    return "unterminated string";
+    case SNS_MSG_INVALID_NONFINITE: return "non-finite value";
+    case SNS_MSG_INVALID_RANGE:     return "value out of range";
+    case SNS_MSG_INVALID_MAX:       break;
+    }
+    return "?";
+}
+
+/*---- Header ----*/
+
+enum sns_msg_invalid
+sns_msg_validate_header( const struct sns_msg_header *msg, size_t frame_size,
+                         const struct sns_msg_schema *schema )
+{
+    if( frame_size < sizeof(*msg) ) return SNS_MSG_INVALID_SIZE;
+    if( schema &&
+        frame_size < schema->var_offset + (size_t)msg->n * schema->elt_size )
+    {
+        return SNS_MSG_INVALID_SIZE;
+    }
+
+    if( msg->nsec >= 1000000000 ) return SNS_MSG_INVALID_TIME;
+
+    if( NULL == memchr(msg->from_host, '\0', sizeof(msg->from_host)) ||
+        NULL == memchr(msg->ident, '\0', sizeof(msg->ident)) )
+    {
+        return SNS_MSG_INVALID_STRING;
+    }
+
+    return SNS_MSG_VALID;
+}
+
+/*---- Payload kernels ----*/
+
+/* Non-finite takes precedence over out of range */
+static enum sns_msg_invalid
+kernel_result( int nonfinite, int range )
+{
+    if( nonfinite ) return SNS_MSG_INVALID_NONFINITE;
+    if( range ) return SNS_MSG_INVALID_RANGE;
+    return SNS_MSG_VALID;
+}
+
+enum sns_msg_invalid
+sns_real_validate( size_t n, const double *x, double min, double max )
+{
+    int nonfinite = 0, range = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    {
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d vmin = _mm_set1_pd(min);
+        const __m128d vmax = _mm_set1_pd(max);
+        __m128d bad_nf = zero, bad_r = zero;
+        for( ; i + 2 <= n; i += 2 ) {
+            __m128d v = _mm_loadu_pd( x + i );
+            /* 0*x is NaN only for NaN and infinity */
+            __m128d z = _mm_mul_pd( v, zero );
+            bad_nf = _mm_or_pd( bad_nf, _mm_cmpunord_pd(z, z) );
+            bad_r = _mm_or_pd( bad_r, _mm_or_pd(_mm_cmplt_pd(v, vmin),
+                                                _mm_cmpgt_pd(v, vmax)) );
+        }
+        nonfinite = _mm_movemask_pd( bad_nf );
+        range = _mm_movemask_pd( bad_r );
+    }
+#endif
+    for( ; i < n; i ++ ) {
+        if( !isfinite(x[i]) ) nonfinite = 1;
+        else if( x[i] < min || x[i] > max ) range = 1;
+    }
+    return kernel_result( nonfinite, range );
+}
+
+enum sns_msg_invalid
+sns_real_f32_validate( size_t n, const float *x, double min, double max )
+{
+    int nonfinite = 0, range = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128d vmin = _mm_set1_pd(min);
+        const __m128d vmax = _mm_set1_pd(max);
+        __m128 bad_nf = zero;
+        __m128d bad_r = _mm_setzero_pd();
+        for( ; i + 4 <= n; i += 4 ) {
+            __m128 v = _mm_loadu_ps( x + i );
+            __m128 z = _mm_mul_ps( v, zero );
+            bad_nf = _mm_or_ps( bad_nf, _mm_cmpunord_ps(z, z) );
+            /* compare in double so min and max are not rounded */
+            __m128d lo = _mm_cvtps_pd( v );
+            __m128d hi = _mm_cvtps_pd( _mm_movehl_ps(v, v) );
+            bad_r = _mm_or_pd( bad_r, _mm_or_pd(_mm_cmplt_pd(lo, vmin),
+                                                _mm_cmpgt_pd(lo, vmax)) );
+            bad_r = _mm_or_pd( bad_r, _mm_or_pd(_mm_cmplt_pd(hi, vmin),
+                                                _mm_cmpgt_pd(hi, vmax)) );
+        }
+        nonfinite = _mm_movemask_ps( bad_nf );
+        range = _mm_movemask_pd( bad_r );
+    }
+#endif
+    for( ; i < n; i ++ ) {
+        if( !isfinite(x[i]) ) nonfinite = 1;
+        else if( x[i] < min || x[i] > max ) range = 1;
+    }
+    return kernel_result( nonfinite, range );
+}
+
+/*---- Schema-driven validation ----*/
+
+static size_t float_size( enum sns_msg_scalar scalar )
+{
+    switch( scalar ) {
+    case SNS_MSG_SCALAR_DOUBLE: return sizeof(double);
+    case SNS_MSG_SCALAR_FLOAT:  return sizeof(float);
+    default:                    return 0;
+    }
+}
+
+static enum sns_msg_invalid
+validate_scalars( enum sns_msg_scalar scalar, const uint8_t *ptr, size_t count,
+                  double min, double max )
+{
+    switch( scalar ) {
+    case SNS_MSG_SCALAR_DOUBLE:
+        return sns_real_validate( count, (const double*)ptr, min, max );
+    case SNS_MSG_SCALAR_FLOAT:
+        return sns_real_f32_validate( count, (const float*)ptr, min, max );
+    default:
+        return SNS_MSG_VALID;
+    }
+}
+
+/* If the element fields are all one floating type and tile the
+ * element, return that scalar so the array can be checked in one
+ * pass. */
+static enum sns_msg_scalar
+elt_uniform( const struct sns_msg_schema *schema )
+{
+    enum sns_msg_scalar scalar = (enum sns_msg_scalar)0;
+    size_t size = 0;
+    for( const struct sns_msg_field *f = schema->elt; f && f->name; f++ ) {
+        size_t s = float_size( f->scalar );
+        if( 0 == s || (scalar && scalar != f->scalar) ) return (enum sns_msg_scalar)0;
+        scalar = f->scalar;
+        size += s * f->count;
+    }
+    return (size == schema->elt_size) ? scalar : (enum sns_msg_scalar)0;
+}
+
+static enum sns_msg_invalid
+validate_payload( const struct sns_msg_validator *v, const void *msg )
+{
+    const struct sns_msg_schema *schema = v->schema;
+    const uint8_t *base = (const uint8_t*)msg;
+    uint32_t n = ((const struct sns_msg_header*)msg)->n;
+    enum sns_msg_invalid r;
+
+    for( const struct sns_msg_field *f = schema->fixed; f && f->name; f++ ) {
+        r = validate_scalars( f->scalar, base + f->offset, f->count, v->min, v->max );
+        if( SNS_MSG_VALID != r ) return r;
+    }
+
+    const uint8_t *var = base + schema->var_offset;
+    enum sns_msg_scalar uniform = elt_uniform( schema );
+    if( uniform ) {
+        size_t count = n * (schema->elt_size / float_size(uniform));
+        return validate_scalars( uniform, var, count, v->min, v->max );
+    }
+
+    for( uint32_t i = 0; i < n; i ++ ) {
+        const uint8_t *elt = var + i * schema->elt_size;
+        for( const struct sns_msg_field *f = schema->elt; f && f->name; f++ ) {
+            r = validate_scalars( f->scalar, elt + f->offset, f->count, v->min, v->max );
+            if( SNS_MSG_VALID != r ) return r;
+        }
+    }
+    return SNS_MSG_VALID;
+}
+
+void sns_msg_validator_init( struct sns_msg_validator *v,
+                             const struct sns_msg_schema *schema )
+{
+    memset( v, 0, sizeof(*v) );
+    v->schema = schema;
+    v->min = -HUGE_VAL;
+    v->max = HUGE_VAL;
+    v->max_age_ns = -1;
+}
+
+enum sns_msg_invalid
+sns_msg_validate( struct sns_msg_validator *v, const void *msg, size_t frame_size )
+{
+    const struct sns_msg_header *header = (const struct sns_msg_header*)msg;
+    v->checked++;
+
+    enum sns_msg_invalid r = sns_msg_validate_header( header, frame_size, v->schema );
+
+    if( SNS_MSG_VALID == r && v->max_age_ns >= 0 ) {
+        struct timespec now;
+        if( 0 == sns_time_get(&now) ) {
+            int64_t age = ((int64_t)now.tv_sec - header->sec) * 1000000000
+                + ((int64_t)now.tv_nsec - (int64_t)header->nsec);
+            if( age > v->max_age_ns ) r = SNS_MSG_INVALID_TIME;
+        }
+    }
+
+    if( SNS_MSG_VALID == r && v->schema ) {
+        r = validate_payload( v, msg );
+    }
+
+    if( SNS_MSG_VALID != r ) v->rejected[r]++;
+    return r;
+}
+
+void sns_msg_validator_log( const struct sns_msg_validator *v,
+                            int priority, const char *name )
+{
+    SNS_LOG( priority,
+             "%s: %"PRIu64" checked, %"PRIu64" bad size, %"PRIu64" bad time, "
+             "%"PRIu64" unterminated, %"PRIu64" non-finite, %"PRIu64" out of range\n",
+             name, v->checked,
+             v->rejected[SNS_MSG_INVALID_SIZE],
+             v->rejected[SNS_MSG_INVALID_TIME],
+             v->rejected[SNS_MSG_INVALID_STRING],
+             v->rejected[SNS_MSG_INVALID_NONFINITE],
+             v->rejected[SNS_MSG_INVALID_RANGE] );
+}
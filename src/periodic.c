@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <inttypes.h>
+#include "sns.h"
+
+static int64_t
+timespec_ns( const struct timespec *t )
+{
+    return (int64_t)t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+static int64_t
+diff_ns( const struct timespec *a, const struct timespec *b )
+{
+    return timespec_ns(a) - timespec_ns(b);
+}
+
+void sns_periodic_init( struct sns_periodic *p, const struct timespec *period,
+                        enum sns_periodic_overrun overrun )
+{
+    memset( p, 0, sizeof(*p) );
+    p->period_ns = timespec_ns( period );
+    SNS_REQUIRE( p->period_ns > 0, "Invalid period\n" );
+    p->overrun = overrun;
+    p->release = sns_time_add_ns( sns_now(), p->period_ns );
+}
+
+int sns_periodic_due( const struct sns_periodic *p, const struct timespec *now )
+{
+    return !SNS_TIME_GT( p->release, (*now) );
+}
+
+struct timespec sns_periodic_remaining( const struct sns_periodic *p,
+                                        const struct timespec *now )
+{
+    int64_t ns = diff_ns( &p->release, now );
+    struct timespec r = {0, 0};
+    if( ns > 0 ) r = sns_time_add_ns( r, ns );
+    return r;
+}
+
+int sns_periodic_wait( const struct sns_periodic *p )
+{
+    return clock_nanosleep( SNS_CLOCK, TIMER_ABSTIME, &p->release, NULL );
+}
+
+void sns_periodic_begin( struct sns_periodic *p, const struct timespec *now )
+{
+    p->start = *now;
+    __atomic_fetch_add( &p->stats.cycles, 1, __ATOMIC_RELAXED );
+    sns_hist_add( p->stats.latency_hist, &p->stats.latency_max_ns,
+                  diff_ns(now, &p->release) );
+}
+
+void sns_periodic_end( struct sns_periodic *p, const struct timespec *now )
+{
+    sns_hist_add( p->stats.exec_hist, &p->stats.exec_max_ns,
+                  diff_ns(now, &p->start) );
+
+    p->release = sns_time_add_ns( p->release, p->period_ns );
+
+    int64_t late = diff_ns( now, &p->release );
+    if( late >= 0 ) {
+        __atomic_fetch_add( &p->stats.overruns, 1, __ATOMIC_RELAXED );
+        if( SNS_PERIODIC_SKIP == p->overrun ) {
+            /* next release strictly after now, on the same grid */
+            int64_t k = late / p->period_ns + 1;
+            p->release = sns_time_add_ns( p->release, k * p->period_ns );
+            __atomic_fetch_add( &p->stats.skipped, (uint64_t)k, __ATOMIC_RELAXED );
+        }
+    }
+}
+
+void sns_periodic_log( const struct sns_periodic *p, int priority, const char *name )
+{
+    const struct sns_periodic_stats *s = &p->stats;
+    /* one site logs every report; keep them out of the rate limit */
+    if( !SNS_LOG_PRIORITY(priority) ) return;
+    sns_event( priority, 0,
+               "%s: %"PRIu64" cycles of %"PRId64" ns, %"PRIu64" overruns, %"PRIu64" skipped, "
+               "latency p50/p99/max <%"PRId64"/<%"PRId64"/%"PRId64" ns, "
+               "exec p50/p99/max <%"PRId64"/<%"PRId64"/%"PRId64" ns\n",
+               name, s->cycles, p->period_ns, s->overruns, s->skipped,
+               sns_hist_quantile(s->latency_hist, 0.5), sns_hist_quantile(s->latency_hist, 0.99),
+               s->latency_max_ns,
+               sns_hist_quantile(s->exec_hist, 0.5), sns_hist_quantile(s->exec_hist, 0.99),
+               s->exec_max_ns );
+}
+
+
+/*--- Timer Wheel ---*/
+
+void sns_timer_init( struct sns_timer *t, const char *name,
+                     const struct timespec *period, const struct timespec *phase,
+                     int priority,
+                     enum ach_status (*handler)(void *context), void *context )
+{
+    memset( t, 0, sizeof(*t) );
+    sns_periodic_init( &t->periodic, period, SNS_PERIODIC_SKIP );
+    /* release holds the phase until the timer is added */
+    t->periodic.release.tv_sec = phase ? phase->tv_sec : 0;
+    t->periodic.release.tv_nsec = phase ? phase->tv_nsec : 0;
+    t->name = name;
+    t->priority = priority;
+    t->handler = handler;
+    t->context = context;
+}
+
+void sns_timer_wheel_init( struct sns_timer_wheel *w, const struct timespec *resolution )
+{
+    memset( w, 0, sizeof(*w) );
+    w->tick_ns = timespec_ns( resolution );
+    SNS_REQUIRE( w->tick_ns > 0, "Invalid timer resolution\n" );
+    w->epoch = sns_now();
+}
+
+static struct timespec
+wheel_tick_time( const struct sns_timer_wheel *w, uint64_t tick )
+{
+    return sns_time_add_ns( w->epoch, (int64_t)tick * w->tick_ns );
+}
+
+/* Link a timer into the slot of the first tick at or after its release */
+static void
+wheel_insert( struct sns_timer_wheel *w, struct sns_timer *t )
+{
+    int64_t d = diff_ns( &t->periodic.release, &w->epoch );
+    uint64_t tick = (d > 0) ? (uint64_t)((d + w->tick_ns - 1) / w->tick_ns) : 0;
+    t->tick = (tick > w->tick) ? tick : w->tick;
+
+    struct sns_timer **slot = w->slots + (t->tick % SNS_TIMER_WHEEL_SLOTS);
+    t->next = *slot;
+    t->prev = slot;
+    if( t->next ) t->next->prev = &t->next;
+    *slot = t;
+}
+
+static void
+wheel_unlink( struct sns_timer *t )
+{
+    *t->prev = t->next;
+    if( t->next ) t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+}
+
+void sns_timer_wheel_add( struct sns_timer_wheel *w, struct sns_timer *t )
+{
+    /* First point of the timer's grid after now */
+    int64_t phase = timespec_ns( &t->periodic.release );
+    struct timespec now = sns_now();
+    int64_t elapsed = diff_ns( &now, &w->epoch ) - phase;
+    int64_t k = (elapsed >= 0) ? elapsed / t->periodic.period_ns + 1 : 0;
+    t->periodic.release = sns_time_add_ns( w->epoch, phase + k * t->periodic.period_ns );
+
+    wheel_insert( w, t );
+    w->n++;
+}
+
+void sns_timer_wheel_remove( struct sns_timer_wheel *w, struct sns_timer *t )
+{
+    /* a running timer is already unlinked; just don't reschedule it */
+    if( t == w->running ) w->running = NULL;
+    else wheel_unlink( t );
+    w->n--;
+}
+
+/* First tick with a timer, or UINT64_MAX if there is none */
+static uint64_t
+wheel_next_tick( const struct sns_timer_wheel *w )
+{
+    /* Scan one revolution; a timer more than a revolution away is
+     * found as the minimum over all slots */
+    uint64_t min = UINT64_MAX;
+    for( uint64_t tick = w->tick; tick < w->tick + SNS_TIMER_WHEEL_SLOTS; tick++ ) {
+        for( struct sns_timer *t = w->slots[tick % SNS_TIMER_WHEEL_SLOTS]; t; t = t->next ) {
+            if( t->tick == tick ) return tick;
+            if( t->tick < min ) min = t->tick;
+        }
+    }
+    return min;
+}
+
+int sns_timer_wheel_next( const struct sns_timer_wheel *w, struct timespec *when )
+{
+    if( 0 == w->n ) return 0;
+    *when = wheel_tick_time( w, wheel_next_tick(w) );
+    return 1;
+}
+
+/* Insert into the due list, ordered by decreasing priority */
+static void
+due_insert( struct sns_timer_wheel *w, struct sns_timer *t )
+{
+    struct sns_timer **due = &w->due;
+    while( *due && (*due)->priority >= t->priority ) due = &(*due)->next;
+    t->next = *due;
+    t->prev = due;
+    if( t->next ) t->next->prev = &t->next;
+    *due = t;
+}
+
+enum ach_status sns_timer_wheel_expire( struct sns_timer_wheel *w, const struct timespec *now )
+{
+    enum ach_status result = ACH_OK;
+
+    /* Jump from one occupied tick to the next, skipping empty ones */
+    while( w->n > 0 ) {
+        uint64_t tick = wheel_next_tick( w );
+        if( SNS_TIME_GT( wheel_tick_time(w, tick), (*now) ) ) break;
+        w->tick = tick;
+
+        /* Collect this tick's timers */
+        struct sns_timer **slot = w->slots + (w->tick % SNS_TIMER_WHEEL_SLOTS);
+        for( struct sns_timer *t = *slot, *next; t; t = next ) {
+            next = t->next;
+            if( t->tick == w->tick ) {
+                wheel_unlink( t );
+                due_insert( w, t );
+            }
+        }
+        w->tick++;
+
+        /* Run and reschedule.  Handlers may remove any timer, which
+         * unlinks it from the due list. */
+        while( w->due ) {
+            struct sns_timer *t = w->due;
+            wheel_unlink( t );
+            w->running = t;
+            struct timespec start = sns_now();
+            sns_periodic_begin( &t->periodic, &start );
+            sns_time_cache_update();
+            enum ach_status r = t->handler( t->context );
+            sns_time_cache_clear();
+            struct timespec end = sns_now();
+            sns_periodic_end( &t->periodic, &end );
+            if( w->running == t ) wheel_insert( w, t );
+            w->running = NULL;
+            if( ACH_OK == result ) result = r;
+        }
+    }
+
+    /* Nothing is due up to now */
+    int64_t d = diff_ns( now, &w->epoch );
+    uint64_t after = (d >= 0) ? (uint64_t)(d / w->tick_ns) + 1 : 0;
+    if( after > w->tick ) w->tick = after;
+    return result;
+}
+
+void sns_timer_wheel_log( const struct sns_timer_wheel *w, int priority )
+{
+    for( size_t i = 0; i < SNS_TIMER_WHEEL_SLOTS; i++ ) {
+        for( const struct sns_timer *t = w->slots[i]; t; t = t->next ) {
+            sns_periodic_log( &t->periodic, priority, t->name ? t->name : "timer" );
+        }
+    }
+}
@@ -129,8 +129,9 @@ int main( int argc, char **argv ) {
     SNS_LOG( LOG_INFO, "verbosity: %d\n", sns_cx.verbosity );
 
     /*-- Obtain Dump Function -- */
-    sns_msg_dump_fun* fun =  (sns_msg_dump_fun*) sns_msg_plugin_symbol( opt_type, "sns_msg_dump" );
-    SNS_REQUIRE( fun, "Couldn't link dump function symbol'\n");
+    const struct sns_msg_type *type = sns_msg_type_lookup( opt_type );
+    SNS_REQUIRE( type, "Unknown message type `%s'\n", opt_type );
+    SNS_REQUIRE( type->dump, "No dump function for message type `%s'\n", opt_type );
 
     /*-- Open channel -- */
     ach_channel_t chan;
@@ -139,7 +140,7 @@ int main( int argc, char **argv ) {
     /* setup handler */
     struct sns_evhandler handlers[1] = {
         {.channel = &chan,
-         .context = fun,
+         .context = (void*)type,
          .ach_options = ACH_O_FIRST,
          .handler = handler
         }
@@ -158,7 +159,7 @@ static enum ach_status
 handler ( void *context, void *msg, size_t msg_size )
 {
     (void)msg_size;
-    sns_msg_dump_fun* fun  = (sns_msg_dump_fun*) context;
-    (fun)(stdout, msg);
+    const struct sns_msg_type *type = (const struct sns_msg_type*) context;
+    type->dump(stdout, msg);
     return ACH_OK;
 }
@@ -136,7 +136,7 @@ int main( int argc, char **argv ) {
 
 
     /*-- Put Message -- */
-    enum ach_status r = ach_put( &sns_cx.chan_log, msg, n_msg );
+    enum ach_status r = sns_msg_put( &sns_cx.chan_log, &msg->header, n_msg );
     if( ACH_OK != r ) {
         fprintf(stderr, "Could not put message: %s\n", ach_result_to_string(r));
         exit(EXIT_FAILURE);
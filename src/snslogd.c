@@ -42,11 +42,17 @@
 /** Author: Neil Dantam
  */
 
+#include "config.h"
+
 #include "sns.h"
 #include <unistd.h>
 #include <syslog.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include "sns/logstore.h"
 
 
 
@@ -54,50 +60,201 @@
 /* PROTOTYPES */
 /*------------*/
 
+/* A log line rendered for the sinks */
+struct entry {
+    int priority;
+    size_t off;         ///< start of the line in text
+    size_t msg_off;     ///< start of the syslog part of the line
+    size_t len;         ///< octets in the line, including the newline
+    size_t raw_off;     ///< start of the frame in raw, for the store
+    size_t raw_size;    ///< octets in the frame
+    struct timespec received;   ///< CLOCK_REALTIME receive time, for the store
+};
+
+/* Log lines handed from the reader to the writer */
+struct batch {
+    struct entry *entry;
+    size_t n;
+    size_t max;
+    char *text;
+    size_t size;
+    size_t max_size;
+    uint8_t *raw;       ///< received frames, when storing
+    size_t raw_used;
+    size_t raw_max;
+};
+
+/* Counters, updated by the reader unless noted */
+struct stats {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t missed;      ///< ACH_MISSED_FRAME results
+    uint64_t invalid;
+    uint64_t dropped;     ///< lines dropped while the writer was behind
+    uint64_t wakeups;
+    uint64_t batch_max;
+    uint64_t written;     ///< lines written, by the writer
+};
+
+typedef struct {
+    struct sns_msg_recv recv;
+    int fd_beep;
+    int fd_file;
+    struct sns_logstore *store;
+
+    pthread_mutex_t mutex;  ///< protects pending, stop, and stats
+    pthread_cond_t cond;
+    struct batch pending;   ///< filled by the reader
+    struct batch writing;   ///< owned by the writer
+    int stop;
+    struct stats stats;
+    pthread_t writer;
+} cx_t;
+
 /* Make a beep */
 static void beep( int fd, int priority );
-/* Process a message */
-static void process( int fd_beep, sns_msg_log_t *msg, size_t frame_size );
+/* Drain pending frames into the pending batch */
+static void drain( cx_t *cx, enum ach_status r, void *buf, size_t frame_size );
+/* Write batches to the sinks */
+static void *writer( void *_cx );
 
+/* Most frames taken per lock of the pending batch */
+#define DRAIN_MAX 4096
+
+/* Most text pending for the writer before lines are dropped */
+#define PENDING_MAX (8*1024*1024)
 
 static const char *opt_console = "/dev/tty0";
+static const char *opt_file = NULL;
+static const char *opt_store = NULL;
+static double opt_segment_mb = 0;
+static size_t opt_keep = 0;
+static int opt_stdout = 0;
+static int opt_syslog = 1;
+static double opt_report = 60;
 
 /* ---- */
 /* MAIN */
 /* ---- */
 int main( int argc, char **argv ) {
-    (void) argc; (void) argv;
+    static cx_t cx;
+    memset(&cx, 0, sizeof cx);
+
+    /*-- Parse Options --*/
+    for( int c; -1 != (c = getopt(argc, argv, "f:oSr:d:z:k:V?" SNS_OPTSTRING)); ) {
+        switch(c) {
+            SNS_OPTCASES
+        case 'f':
+            opt_file = optarg;
+            break;
+        case 'o':
+            opt_stdout = 1;
+            break;
+        case 'S':
+            opt_syslog = 0;
+            break;
+        case 'r':
+            opt_report = atof(optarg);
+            break;
+        case 'd':
+            opt_store = optarg;
+            break;
+        case 'z':
+            opt_segment_mb = atof(optarg);
+            break;
+        case 'k':
+            opt_keep = (size_t)atol(optarg);
+            break;
+        case 'V':   /* version     */
+            puts( "snslogd " PACKAGE_VERSION "\n"
+                  "\n"
+                  "Copyright (c) 2010-2011, Georgia Tech Research Corporation\n"
+                  "This is free software; see the source for copying conditions.  There is NO\n"
+                  "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n"
+                  "\n"
+                  "Written by Neil T. Dantam"
+                );
+            exit(EXIT_SUCCESS);
+        case '?':   /* help     */
+            puts( "Usage: snslogd [OPTIONS...]\n"
+                  "Write SNS log messages to syslog and files\n"
+                  "\n"
+                  "Options:\n"
+                  "  -f FILE,                     Append log lines to FILE\n"
+                  "  -o,                          Print log lines to stdout\n"
+                  "  -S,                          Do not send to syslog\n"
+                  "  -r SECONDS,                  Statistics report interval, 0 to disable (default 60)\n"
+                  "  -d DIRECTORY,                Store messages in DIRECTORY, see snslogq\n"
+                  "  -z MEGABYTES,                Store segment size (default 64)\n"
+                  "  -k COUNT,                    Store segments to keep, 0 for all (default 0)\n"
+                  "  -?,                          Give program help list\n"
+                  "  -V,                          Print program version\n"
+                  "\n"
+                  "Report bugs to <ntd@gatech.edu>"
+                );
+            exit(EXIT_SUCCESS);
+        default:
+            fprintf(stderr, "Invalid arg: %s\n", optarg);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     sns_cx.verbosity = 10;
     sns_init();
     openlog("sns", isatty(STDERR_FILENO) ? LOG_PERROR : 0, LOG_USER);
 
-    int fd_beep = open(opt_console, O_WRONLY);
+    cx.fd_beep = open(opt_console, O_WRONLY);
 
     // open console
-    if( fd_beep < 0 ) {
+    if( cx.fd_beep < 0 ) {
         syslog(LOG_ERR, "couldn't open `%s' to beep: %s\n",
                opt_console, strerror(errno));
     }
 
+    // open file
+    cx.fd_file = -1;
+    if( opt_file ) {
+        cx.fd_file = open(opt_file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        SNS_REQUIRE( cx.fd_file >= 0, "Could not open `%s': %s\n",
+                     opt_file, strerror(errno) );
+    }
+
+    // open store
+    static struct sns_logstore store;
+    if( opt_store ) {
+        SNS_REQUIRE( 0 == sns_logstore_open(&store, opt_store,
+                                            (size_t)(opt_segment_mb * 1024 * 1024),
+                                            opt_keep),
+                     "Could not open store `%s': %s\n", opt_store, strerror(errno) );
+        cx.store = &store;
+    }
+
     // cancel handlers
     {
         ach_channel_t *chans[] = {&sns_cx.chan_log, NULL};
         sns_sigcancel( chans, sns_sig_term_default );
     }
 
+    // writer thread
+    pthread_mutex_init( &cx.mutex, NULL );
+    pthread_cond_init( &cx.cond, NULL );
+    {
+        int e = pthread_create( &cx.writer, NULL, writer, &cx );
+        SNS_REQUIRE( 0 == e, "Could not create writer thread: %s\n", strerror(e) );
+    }
+
     sns_start();
 
+    sns_msg_recv_init( &cx.recv, &sns_cx.chan_log, 0 );
+
     while( !sns_cx.shutdown ) {
         size_t frame_size;
         void *buf;
-        ach_status_t r = sns_msg_local_get( &sns_cx.chan_log, &buf, &frame_size, NULL, ACH_O_WAIT );
+        ach_status_t r = sns_msg_recv_get( &cx.recv, &buf, &frame_size, NULL, ACH_O_WAIT );
         switch(r) {
         case ACH_MISSED_FRAME:
-            syslog(LOG_WARNING, "missed log frame: %s", ach_result_to_string(r));
         case ACH_OK:
-            /* process message */
-            process( fd_beep, (sns_msg_log_t*)buf, frame_size );
+            drain( &cx, r, buf, frame_size );
             break;
         case ACH_CANCELED:
             break;
@@ -107,26 +264,219 @@ int main( int argc, char **argv ) {
         aa_mem_region_local_release();
     }
 
-    close(fd_beep);
+    // flush and stop the writer
+    pthread_mutex_lock( &cx.mutex );
+    cx.stop = 1;
+    pthread_cond_signal( &cx.cond );
+    pthread_mutex_unlock( &cx.mutex );
+    pthread_join( cx.writer, NULL );
+
+    sns_msg_recv_destroy( &cx.recv );
+    if( cx.fd_file >= 0 ) close(cx.fd_file);
+    if( cx.store ) sns_logstore_close( cx.store );
+    close(cx.fd_beep);
     sns_end();
 
     return 0;
 }
 
-static void process( int fd_beep, sns_msg_log_t *msg, size_t frame_size ) {
-    if( SNS_MSG_CHECK_SIZE(log, msg, frame_size) ) {
-        beep(fd_beep, LOG_ERR);
-        syslog(LOG_ERR, "Invalid message size: %"PRIuPTR, frame_size);
-        return;
-    } /* else, log the message */
-
-    /* Log it */
-    syslog( msg->priority, "[%s(%"PRIu64")@%s] %s",
-            sns_str_nullterm(msg->header.ident, sizeof(msg->header.from_host)),
-            msg->header.from_pid,
-            sns_str_nullterm(msg->header.from_host, sizeof(msg->header.from_host)),
-            sns_str_nullterm(msg->text, msg->header.n) );
-    beep(fd_beep, msg->priority);
+/* Append a log line for the frame to the batch, false if there is no room */
+static int append( struct batch *b, void *buf, size_t frame_size, int store,
+                   const struct timespec *received ) {
+    int priority;
+    const char *text = sns_msg_log_text( buf, frame_size, &priority );
+    if( NULL == text ) {
+        syslog(LOG_ERR, "Invalid log message of size: %"PRIuPTR, frame_size);
+        return 1;
+    }
+    const struct sns_msg_header *h = (const struct sns_msg_header*)buf;
+
+    /* message time and priority for files, then the syslog part */
+    char stamp[64];
+    size_t n_stamp = (size_t)snprintf( stamp, sizeof(stamp), "%"PRId64".%09"PRIu32" <%d> ",
+                                       h->sec, h->nsec, priority );
+
+    size_t n_text = strlen(text);
+    int newline = (0 == n_text || '\n' != text[n_text-1]);
+    size_t n_line = n_stamp + SNS_IDENT_LEN + SNS_HOSTNAME_LEN + 32 + n_text + 1;
+    size_t n_raw = store ? frame_size : 0;
+    if( b->size + n_line + b->raw_used + n_raw > PENDING_MAX ) return 0;
+
+    if( b->n == b->max ) {
+        b->max = b->max ? 2*b->max : 256;
+        b->entry = (struct entry*)realloc( b->entry, b->max * sizeof(b->entry[0]) );
+        SNS_REQUIRE( b->entry, "Could not allocate log batch\n" );
+    }
+    if( b->size + n_line > b->max_size ) {
+        while( b->size + n_line > b->max_size ) {
+            b->max_size = b->max_size ? 2*b->max_size : 64*1024;
+        }
+        b->text = (char*)realloc( b->text, b->max_size );
+        SNS_REQUIRE( b->text, "Could not allocate log batch\n" );
+    }
+    if( b->raw_used + n_raw > b->raw_max ) {
+        while( b->raw_used + n_raw > b->raw_max ) {
+            b->raw_max = b->raw_max ? 2*b->raw_max : 64*1024;
+        }
+        b->raw = (uint8_t*)realloc( b->raw, b->raw_max );
+        SNS_REQUIRE( b->raw, "Could not allocate log batch\n" );
+    }
+
+    struct entry *e = b->entry + b->n++;
+    e->priority = priority;
+    e->off = b->size;
+    e->msg_off = b->size + n_stamp;
+    memcpy( b->text + b->size, stamp, n_stamp );
+    int n = snprintf( b->text + e->msg_off, n_line - n_stamp, "[%.*s(%"PRIu64")@%.*s] %s%s",
+                      (int)strnlen(h->ident, sizeof(h->ident)), h->ident,
+                      h->from_pid,
+                      (int)strnlen(h->from_host, sizeof(h->from_host)), h->from_host,
+                      text, newline ? "\n" : "" );
+    e->len = n_stamp + (size_t)n;
+    b->size += e->len;
+    e->raw_off = b->raw_used;
+    e->raw_size = n_raw;
+    e->received = *received;
+    if( n_raw ) memcpy( b->raw + b->raw_used, buf, n_raw );
+    b->raw_used += n_raw;
+    return 1;
+}
+
+static void drain( cx_t *cx, enum ach_status r, void *buf, size_t frame_size ) {
+    /* wall clock, since message times restart at each boot */
+    struct timespec received;
+    clock_gettime( CLOCK_REALTIME, &received );
+    pthread_mutex_lock( &cx->mutex );
+    cx->stats.wakeups++;
+    uint64_t n = 0;
+    for(;;) {
+        if( ACH_MISSED_FRAME == r ) cx->stats.missed++;
+        cx->stats.frames++;
+        cx->stats.bytes += frame_size;
+        n++;
+        size_t n_entry = cx->pending.n;
+        if( !append( &cx->pending, buf, frame_size, NULL != cx->store, &received ) ) {
+            cx->stats.dropped++;
+        } else if( n_entry == cx->pending.n ) {
+            cx->stats.invalid++;
+        }
+
+        if( n >= DRAIN_MAX ) break;
+        r = sns_msg_recv_get( &cx->recv, &buf, &frame_size, NULL, 0 );
+        if( ACH_OK != r && ACH_MISSED_FRAME != r ) break;
+    }
+    if( n > cx->stats.batch_max ) cx->stats.batch_max = n;
+    pthread_cond_signal( &cx->cond );
+    pthread_mutex_unlock( &cx->mutex );
+}
+
+/* Write lines to fd, from start of each line */
+static void write_lines( int fd, const struct batch *b, const char *what ) {
+    size_t i = 0;
+    while( i < b->n ) {
+        struct iovec iov[IOV_MAX];
+        int n_iov = 0;
+        for( ; i < b->n && n_iov < IOV_MAX; i++, n_iov++ ) {
+            iov[n_iov].iov_base = b->text + b->entry[i].off;
+            iov[n_iov].iov_len = b->entry[i].len;
+        }
+        if( sns_writev_all(fd, iov, n_iov) ) {
+            syslog(LOG_ERR, "Could not write %s: %s", what, strerror(errno));
+            return;
+        }
+    }
+}
+
+/* Append the frames of a batch to the store */
+static void store_frames( struct sns_logstore *store, const struct batch *b ) {
+    const void **frames = (const void**)malloc( b->n * sizeof(frames[0]) );
+    size_t *sizes = (size_t*)malloc( b->n * sizeof(sizes[0]) );
+    struct timespec *received = (struct timespec*)malloc( b->n * sizeof(received[0]) );
+    SNS_REQUIRE( frames && sizes && received, "Could not allocate store batch\n" );
+    for( size_t i = 0; i < b->n; i ++ ) {
+        frames[i] = b->raw + b->entry[i].raw_off;
+        sizes[i] = b->entry[i].raw_size;
+        received[i] = b->entry[i].received;
+    }
+    if( sns_logstore_append(store, b->n, frames, sizes, received) ) {
+        syslog(LOG_ERR, "Could not write store: %s", strerror(errno));
+    }
+    free( frames );
+    free( sizes );
+    free( received );
+}
+
+static void report( const struct stats *s, double dt ) {
+    syslog( LOG_INFO,
+            "snslogd: %"PRIu64" frames (%.1f/s), %"PRIu64" bytes, %"PRIu64" written, "
+            "%"PRIu64" missed, %"PRIu64" dropped, %"PRIu64" invalid, "
+            "%"PRIu64" wakeups, max batch %"PRIu64,
+            s->frames, dt > 0 ? (double)s->frames / dt : 0.0, s->bytes, s->written,
+            s->missed, s->dropped, s->invalid, s->wakeups, s->batch_max );
+}
+
+static void *writer( void *_cx ) {
+    cx_t *cx = (cx_t*)_cx;
+    int64_t report_ns = (int64_t)(opt_report * 1e9);
+    struct timespec start, next;
+    /* condition variables time out on the realtime clock */
+    clock_gettime( CLOCK_REALTIME, &start );
+    next = sns_time_add_ns( start, report_ns );
+
+    for(;;) {
+        /* take the pending batch */
+        pthread_mutex_lock( &cx->mutex );
+        while( !cx->stop && 0 == cx->pending.n ) {
+            if( report_ns > 0 ) {
+                if( ETIMEDOUT == pthread_cond_timedwait(&cx->cond, &cx->mutex, &next) ) break;
+            } else {
+                pthread_cond_wait( &cx->cond, &cx->mutex );
+            }
+        }
+        struct batch tmp = cx->writing;
+        cx->writing = cx->pending;
+        cx->pending = tmp;
+        cx->pending.n = 0;
+        cx->pending.size = 0;
+        cx->pending.raw_used = 0;
+        cx->stats.written += cx->writing.n;
+        struct stats s = cx->stats;
+        int stop = cx->stop;
+        pthread_mutex_unlock( &cx->mutex );
+
+        /* sinks */
+        struct batch *b = &cx->writing;
+        if( opt_syslog ) {
+            for( size_t i = 0; i < b->n; i ++ ) {
+                struct entry *e = b->entry + i;
+                syslog( e->priority, "%.*s", (int)(e->len - (e->msg_off - e->off)),
+                        b->text + e->msg_off );
+            }
+        }
+        if( cx->fd_file >= 0 ) write_lines( cx->fd_file, b, "log file" );
+        if( opt_stdout ) write_lines( STDOUT_FILENO, b, "stdout" );
+        if( cx->store && b->n ) store_frames( cx->store, b );
+        for( size_t i = 0; i < b->n; i ++ ) {
+            beep( cx->fd_beep, b->entry[i].priority );
+        }
+
+        /* statistics */
+        if( report_ns > 0 ) {
+            struct timespec now;
+            clock_gettime( CLOCK_REALTIME, &now );
+            if( stop || !SNS_TIME_GT(next, now) ) {
+                report( &s, (double)(now.tv_sec - start.tv_sec) +
+                        (double)(now.tv_nsec - start.tv_nsec) / 1e9 );
+                next = sns_time_add_ns( now, report_ns );
+            }
+        }
+        if( stop ) break;
+    }
+
+    free( cx->writing.entry );
+    free( cx->writing.text );
+    free( cx->writing.raw );
+    return NULL;
 }
 
 static void beep( int fd, int priority ) {
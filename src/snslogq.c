@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2015, Rice University.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written
+ *       permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "sns.h"
+#include "sns/logstore.h"
+
+/* ------- */
+/* GLOBALS */
+/* ------- */
+
+static const char *opt_dir = NULL;
+static const char *opt_ident = NULL;
+static int opt_priority = LOG_DEBUG;
+static int opt_count = 0;
+static int have_start = 0, have_end = 0;
+static double opt_last = 0;
+static struct timespec opt_start, opt_end;
+
+/* ------- */
+/* HELPERS */
+/* ------- */
+
+static struct timespec parse_time( const char *arg ) {
+    char *end;
+    double x = strtod( arg, &end );
+    SNS_REQUIRE( end != arg && '\0' == *end && x >= 0, "Invalid time: `%s'\n", arg );
+    struct timespec t;
+    t.tv_sec = (time_t)x;
+    t.tv_nsec = (long)((x - (double)t.tv_sec) * 1e9);
+    return t;
+}
+
+static struct timespec entry_time( const struct sns_logstore_entry *e ) {
+    struct timespec t = {(time_t)e->sec, (long)e->nsec};
+    return t;
+}
+
+static struct timespec entry_max( const struct sns_logstore_entry *e ) {
+    struct timespec t = {(time_t)e->max_sec, (long)e->max_nsec};
+    return t;
+}
+
+/* Latest time in the store, from the index headers */
+static int store_latest( uint64_t *segments, size_t n, struct timespec *latest ) {
+    for( size_t i = n; i > 0; i -- ) {
+        struct timespec min;
+        if( 1 == sns_logstore_range(opt_dir, segments[i-1], &min, latest) ) return 1;
+    }
+    return 0;
+}
+
+/* Whether a segment may have entries in the queried times */
+static int segment_overlaps( uint64_t segment ) {
+    struct timespec min, max;
+    int r = sns_logstore_range( opt_dir, segment, &min, &max );
+    if( r < 0 ) return 1;   /* let mapping report the error */
+    if( 0 == r ) return 0;
+    if( have_start && SNS_TIME_GT(opt_start, max) ) return 0;
+    if( have_end && SNS_TIME_GT(min, opt_end) ) return 0;
+    return 1;
+}
+
+static int match( const struct sns_logstore_entry *e ) {
+    if( e->priority > opt_priority ) return 0;
+    if( opt_ident && strncmp(opt_ident, e->ident, sizeof(e->ident)) ) return 0;
+    struct timespec t = entry_time( e );
+    if( have_start && SNS_TIME_GT(opt_start, t) ) return 0;
+    if( have_end && SNS_TIME_GT(t, opt_end) ) return 0;
+    return 1;
+}
+
+/* Lines start with the receive time, which -s and -e take */
+static void print( const struct sns_logstore_segment *seg,
+                   const struct sns_logstore_entry *e ) {
+    const struct sns_msg_header *h =
+        (const struct sns_msg_header*)sns_logstore_frame( seg, e );
+    int priority;
+    const char *text = sns_msg_log_text( h, e->size, &priority );
+    if( NULL == text ) text = "(invalid message)\n";
+    size_t n = strlen(text);
+    printf( "%"PRId64".%09"PRIu32" <%d> [%.*s(%"PRIu64")@%.*s] %s%s",
+            e->sec, e->nsec, priority,
+            (int)strnlen(h->ident, sizeof(h->ident)), h->ident,
+            h->from_pid,
+            (int)strnlen(h->from_host, sizeof(h->from_host)), h->from_host,
+            text, (0 == n || '\n' != text[n-1]) ? "\n" : "" );
+    aa_mem_region_local_release();
+}
+
+static size_t query( void ) {
+    uint64_t *segments;
+    ssize_t n_seg = sns_logstore_list( opt_dir, &segments );
+    SNS_REQUIRE( n_seg >= 0, "Could not read store `%s': %s\n", opt_dir, strerror(errno) );
+
+    if( opt_last > 0 ) {
+        struct timespec latest;
+        if( !store_latest(segments, (size_t)n_seg, &latest) ) {
+            free( segments );
+            return 0;
+        }
+        opt_start = sns_time_add_ns( latest, -(int64_t)(opt_last * 1e9) );
+        have_start = 1;
+    }
+    struct timespec stop = have_end ?
+        sns_time_add_ns( opt_end, SNS_LOGSTORE_SKEW_NS ) : opt_end;
+
+    size_t count = 0;
+    for( size_t k = 0; k < (size_t)n_seg; k ++ ) {
+        if( !segment_overlaps(segments[k]) ) continue;
+        struct sns_logstore_segment seg;
+        if( sns_logstore_map(&seg, opt_dir, segments[k]) ) {
+            SNS_LOG( LOG_WARNING, "Could not map segment %"PRIu64": %s\n",
+                     segments[k], strerror(errno) );
+            continue;
+        }
+        /* Search every overlapping segment: the clock may have
+         * stepped back between them, e.g., after a reboot before time
+         * sync */
+        size_t i = have_start ? sns_logstore_find( &seg, &opt_start ) : 0;
+        for( ; i < seg.n; i ++ ) {
+            const struct sns_logstore_entry *e = seg.index + i;
+            if( have_end ) {
+                struct timespec max = entry_max( e );
+                if( SNS_TIME_GT(max, stop) ) break;
+            }
+            if( match(e) ) {
+                count++;
+                if( !opt_count ) print( &seg, e );
+            }
+        }
+        sns_logstore_unmap( &seg );
+    }
+
+    free( segments );
+    return count;
+}
+
+/* ---- */
+/* MAIN */
+/* ---- */
+
+static void posarg( char *arg, int i ) {
+    if( 0 == i ) {
+        opt_dir = strdup(arg);
+    } else {
+        fprintf(stderr, "Invalid arg: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main( int argc, char **argv ) {
+    /*-- Parse Options --*/
+    int i = 0;
+    for( int c; -1 != (c = getopt(argc, argv, "s:e:l:i:p:cV?" SNS_OPTSTRING)); ) {
+        switch(c) {
+            SNS_OPTCASES
+        case 's':
+            opt_start = parse_time( optarg );
+            have_start = 1;
+            break;
+        case 'e':
+            opt_end = parse_time( optarg );
+            have_end = 1;
+            break;
+        case 'l':
+            opt_last = atof( optarg );
+            break;
+        case 'i':
+            opt_ident = optarg;
+            break;
+        case 'p':
+            opt_priority = atoi( optarg );
+            break;
+        case 'c':
+            opt_count = 1;
+            break;
+        case 'V':   /* version     */
+            puts( "snslogq " PACKAGE_VERSION "\n"
+                  "\n"
+                  "Copyright (c) 2015, Rice University\n"
+                  "This is free software; see the source for copying conditions.  There is NO\n"
+                  "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n"
+                );
+            exit(EXIT_SUCCESS);
+        case '?':   /* help     */
+            puts( "Usage: snslogq [OPTIONS...] directory\n"
+                  "Query a log store written by snslogd -d\n"
+                  "\n"
+                  "Options:\n"
+                  "  -s SECONDS,                  Start receive time, in seconds since the epoch\n"
+                  "  -e SECONDS,                  End receive time\n"
+                  "  -l SECONDS,                  Only the last SECONDS before the newest message\n"
+                  "  -i IDENT,                    Only messages from IDENT\n"
+                  "  -p PRIORITY,                 Only messages of PRIORITY or more severe (0-7)\n"
+                  "  -c,                          Print the number of messages\n"
+                  "  -?,                          Give program help list\n"
+                  "  -V,                          Print program version\n"
+                );
+            exit(EXIT_SUCCESS);
+            break;
+        default:
+            posarg( optarg, i++ );
+        }
+    }
+    while( optind < argc ) {
+        posarg(argv[optind++], i++);
+    }
+    SNS_REQUIRE( opt_dir, "No store directory given\n" );
+
+    /*-- Run --*/
+    size_t count = query();
+    if( opt_count ) printf( "%"PRIuPTR"\n", count );
+
+    return 0;
+}
@@ -67,6 +67,7 @@ typedef struct {
 
 typedef struct {
     ach_channel_t chan_in;
+    struct sns_msg_recv recv;
     gnuplot_live_t plot;
     size_t n_msg;
     sns_msg_plot_sample_fun* fun;
@@ -130,6 +131,7 @@ static void init(cx_t *cx) {
     // open channel
     sns_chan_open( &cx->chan_in,
                    opt_channel, NULL );
+    sns_msg_recv_init( &cx->recv, &cx->chan_in, 0 );
 
     // open gnuplot
     {
@@ -145,9 +147,13 @@ static void init(cx_t *cx) {
     //fprintf(cx->plot.gnuplot, "set ylabel '%s\n", opt_quantity);
     fprintf(cx->plot.gnuplot, "set yrange [%f:%f]\n", opt_range_min, opt_range_max);
 
-    // get plugin
-    cx->fun = (sns_msg_plot_sample_fun*) sns_msg_plugin_symbol( opt_type, "sns_msg_plot_sample" );
-    SNS_REQUIRE( cx->fun, "Couldn't dlsym for %s\n", opt_type );
+    // get message type
+    {
+        const struct sns_msg_type *type = sns_msg_type_lookup( opt_type );
+        SNS_REQUIRE( type, "Unknown message type `%s'\n", opt_type );
+        cx->fun = type->plot_sample;
+        SNS_REQUIRE( cx->fun, "No plot_sample function for message type `%s'\n", opt_type );
+    }
 
     // init struct
     char **labels;
@@ -166,8 +172,8 @@ static void next_msg(cx_t *cx, double **samples, char ***labels, size_t *n) {
     void *buf;
     size_t frame_size;
 
-    ach_status_t r = sns_msg_local_get( &cx->chan_in, &buf, &frame_size,
-                                        NULL, ACH_O_WAIT );
+    ach_status_t r = sns_msg_recv_get( &cx->recv, &buf, &frame_size,
+                                       NULL, ACH_O_WAIT );
 
     SNS_REQUIRE( (ACH_OK == r) || (ACH_MISSED_FRAME == r),
                  "Couldn't get frame: %s\n", ach_result_to_string(r) );
@@ -203,6 +209,7 @@ static void run(cx_t *cx) {
 
 void destroy(cx_t *cx) {
     // close channel
+    sns_msg_recv_destroy( &cx->recv );
     sns_chan_close( &cx->chan_in );
     // close gnuplot
     fclose( cx->plot.gnuplot );
@@ -55,6 +55,7 @@
 
 typedef struct {
     ach_channel_t chan;
+    struct sns_msg_recv recv;
     FILE *out;
     size_t n;
     sns_msg_plot_sample_fun* fun;
@@ -87,6 +88,7 @@ static void init(cx_t *cx) {
     // open channel
     sns_chan_open( &cx->chan,
                    opt_channel, NULL );
+    sns_msg_recv_init( &cx->recv, &cx->chan, 0 );
 
     // open output
     if( opt_out && 0 != strcmp(opt_out,"-") ) {
@@ -96,9 +98,13 @@ static void init(cx_t *cx) {
         cx->out = stdout;
     }
 
-    // get plugin
-    cx->fun = (sns_msg_plot_sample_fun*) sns_msg_plugin_symbol( opt_type, "sns_msg_plot_sample" );
-    SNS_REQUIRE( cx->fun, "Couldn't dlsym for %s\n", opt_type );
+    // get message type
+    {
+        const struct sns_msg_type *type = sns_msg_type_lookup( opt_type );
+        SNS_REQUIRE( type, "Unknown message type `%s'\n", opt_type );
+        cx->fun = type->plot_sample;
+        SNS_REQUIRE( cx->fun, "No plot_sample function for message type `%s'\n", opt_type );
+    }
 
     {
         ach_channel_t *chans[] = {&cx->chan, NULL};
@@ -118,8 +124,8 @@ static void update(cx_t *cx, int header) {
     struct sns_msg_header *buf;
     {
         size_t frame_size;
-        ach_status_t r = sns_msg_local_get( &cx->chan, (void**)&buf, &frame_size,
-                                            NULL, ACH_O_WAIT );
+        ach_status_t r = sns_msg_recv_get( &cx->recv, (void**)&buf, &frame_size,
+                                           NULL, ACH_O_WAIT );
 
         if( ACH_CANCELED == r ) return;
         SNS_REQUIRE( (ACH_OK == r) || (ACH_MISSED_FRAME == r),
@@ -170,6 +176,7 @@ static void run(cx_t *cx) {
 
 void destroy(cx_t *cx) {
     fclose(cx->out);
+    sns_msg_recv_destroy( &cx->recv );
     sns_chan_close( &cx->chan );
     sns_end();
 }
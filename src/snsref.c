@@ -150,7 +150,7 @@ int main( int argc, char **argv ) {
 
     /*-- Send Message --*/
     if( SNS_LOG_PRIORITY(LOG_INFO) ) sns_msg_motor_ref_dump( stdout, msg );
-    enum ach_status r = ach_put( &chan, msg, sns_msg_motor_ref_size(msg) );
+    enum ach_status r = sns_msg_motor_ref_put( &chan, msg );
     if( ACH_OK == r ) return 0;
     else {
         fprintf( stderr, "Failed to put message: %s\n", ach_result_to_string(r) );
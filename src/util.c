@@ -45,6 +45,7 @@
 #include "sns.h"
 #include <linux/kd.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 
@@ -61,6 +62,77 @@ int sns_beep( int fd, double freq, double dur ) {
     return 0;//return write(fd, "\a", 1);
 }
 
+/* Per-thread time cache for sns_time_get() */
+static __thread struct timespec time_cache;
+static __thread int time_cache_valid;
+
+void sns_time_cache_update( void ) {
+    time_cache_valid = (0 == clock_gettime( SNS_CLOCK, &time_cache ));
+}
+
+void sns_time_cache_clear( void ) {
+    time_cache_valid = 0;
+}
+
+int sns_time_get( struct timespec *now ) {
+    if( time_cache_valid ) {
+        *now = time_cache;
+        return 0;
+    }
+    return clock_gettime( SNS_CLOCK, now );
+}
+
+static size_t hist_bin( int64_t ns ) {
+    if( ns <= 0 ) return 0;
+    size_t k = (size_t)(64 - __builtin_clzll((unsigned long long)ns));
+    return (k < SNS_HIST_BINS) ? k : SNS_HIST_BINS - 1;
+}
+
+void sns_hist_add( uint64_t *hist, int64_t *max_ns, int64_t ns ) {
+    /* single writer, so no locked instruction */
+    uint64_t *bin = hist + hist_bin(ns);
+    __atomic_store_n( bin, __atomic_load_n(bin, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED );
+    if( ns > __atomic_load_n(max_ns, __ATOMIC_RELAXED) ) {
+        __atomic_store_n( max_ns, ns, __ATOMIC_RELAXED );
+    }
+}
+
+int64_t sns_hist_quantile( const uint64_t *hist, double q ) {
+    uint64_t total = 0;
+    for( size_t i = 0; i < SNS_HIST_BINS; i ++ ) total += hist[i];
+    if( 0 == total ) return 0;
+
+    uint64_t target = (uint64_t)(q * (double)total);
+    uint64_t sum = 0;
+    for( size_t i = 0; i < SNS_HIST_BINS; i ++ ) {
+        sum += hist[i];
+        if( sum > target ) return i ? (int64_t)1 << i : 0;
+    }
+    return (int64_t)1 << (SNS_HIST_BINS - 1);
+}
+
+int sns_writev_all( int fd, struct iovec *iov, int n_iov ) {
+    while( n_iov > 0 ) {
+        ssize_t w = writev( fd, iov, n_iov );
+        if( w < 0 ) {
+            if( EINTR == errno ) continue;
+            return -1;
+        }
+        /* skip what was written */
+        size_t k = (size_t)w;
+        while( n_iov > 0 && k >= iov->iov_len ) {
+            k -= iov->iov_len;
+            iov++;
+            n_iov--;
+        }
+        if( n_iov > 0 ) {
+            iov->iov_base = (uint8_t*)iov->iov_base + k;
+            iov->iov_len -= k;
+        }
+    }
+    return 0;
+}
+
 const char *sns_str_nullterm( const char *text, size_t n ) {
     if( 0 == n ) return "";
     size_t i = strnlen(text, n);